@@ -21,7 +21,10 @@
 #include "./settings.h"
 #include "./src/FreeDeck.h"
 #include "./src/FreeDeckSerialAPI.h"
+#include "./src/MemoryFree.h"
+#include "./src/Profiler.h"
 void setup() {
+  paintStack();
   Serial.begin(4000000);
   Serial.setTimeout(100);
   delay(BOOT_DELAY);
@@ -38,16 +41,15 @@ void setup() {
 #if BD_COUNT > 8
   pinMode(S3_PIN, OUTPUT);
 #endif
-  initAllDisplays(I2C_DELAY, PRE_CHARGE_PERIOD, REFRESH_FREQUENCY);
-  delay(100);
   initSdCard();
   postSetup();
 }
 
 void loop() {
+  PROFILE(PROBE_LOOP);
   handleSerial();
   sleepTask();
-  for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
-    checkButtonState(buttonIndex);
-  }
+  buttonTask();
+  macroTask();
+  prefetchTask();
 }
@@ -29,23 +29,54 @@
 #define S2_PIN 9
 #define S3_PIN 10
 
-// the size of the image chunks send to the displays
-// try different values here. good displays can go higher.
+// time for the button multiplexer to settle before reading BUTTON_PIN
+#define MUX_SETTLE_US 5
+// time for the display multiplexer to settle before talking to a display,
+// increase this if displays miss commands after switching
+#define DISPLAY_MUX_SETTLE_US 20
+// the buttons are sampled every SCAN_INTERVAL_US and need 4 equal
+// samples in a row to change state
+#define SCAN_INTERVAL_US 1000
+
+// the size of the image chunks read from the sd card
+// try different values here. needs to be a multiple of 128.
 // 512 for example.
-// worse need to go lower. 64 for example
 #define IMG_CACHE_SIZE 128
 
+// pages the navigation buttons of the current page lead to, whose image
+// locations are looked up in idle time. costs 3 + 4 * BD_COUNT bytes of ram each
+#define PREFETCH_PAGES 2
+
+// ram the big buffers (sd card, files, image cache, display state, actions,
+// prefetch and profiler) may take of the 2560 bytes of the 32u4. the rest is
+// left for the stack, usb and the arduino core. frame 0x13 shows how much
+// stack was actually used
+#define RAM_BUDGET 1792
+
 // the duration it takes after a long press is triggered
 // maybe move this to the configurator?
 #define LONG_PRESS_DURATION 300
 #define PAGE_CHANGE_SERIAL_TIMEOUT 1500
 
+// default time per character when typing text, in ms. a button can
+// set its own with the upper nibble of its command (nibble * 4 ms)
+#define TEXT_CHAR_DELAY 8
+
+// record timing histograms of the main loop and its tasks, readable with
+// frame 0x12. costs about 400 bytes of ram and some time in every task
+// #define PROFILER
+
 // the delay to wait for everything to "boot"
 // increase to 1500-1800 or higher if some displays dont
 // startup right away
 #define BOOT_DELAY 0
 #define CONFIG_NAME "config.bin"
 #define TEMP_FILE "config.bin.tmp"
+// profile 0 is CONFIG_NAME, profile n is PROFILE_NAME with n filled in.
+// the active profile is kept in the EEPROM at PROFILE_EEPROM_ADDRESS
+#define PROFILE_NAME "config%u.bin"
+#define PROFILE_COUNT 16  // at most 100, the names have to stay 8.3
+#define PROFILE_EEPROM_ADDRESS 0
 #define MAX_CACHE 32
 
 // Change this value from 0x11 up to 0xff to reduce coil whine. different
@@ -70,6 +101,20 @@
 #define BB_SDA 2  // ARDUINO:RX_PIN:D0 32U4:20:PD2
 #define BB_SCL 3  // ARDUINO:TX_PIN:D1 32U4:21:PD3
 
+// how the displays are driven
+// I2C_BITBANG: bit banged on BB_SDA/BB_SCL, slowed down by I2C_DELAY
+// I2C_BITBANG_FAST: bit banged on BB_SDA/BB_SCL, unrolled and timed in cpu
+// cycles for I2C_FAST_HZ, the I2C delay of the config is ignored
+// I2C_HARDWARE: the TWI of the 32u4 at I2C_HARDWARE_HZ. SDA has to be wired
+// to PD1 (ARDUINO:D2) and SCL to PD0 (ARDUINO:D3) instead of BB_SDA/BB_SCL
+#define I2C_BITBANG 0
+#define I2C_BITBANG_FAST 1
+#define I2C_HARDWARE 2
+#define I2C_TRANSPORT I2C_BITBANG
+#define I2C_FAST_HZ 800000L
+#define I2C_HARDWARE_HZ 400000L
+// #define I2C_HARDWARE_HZ 1000000L // good displays only
+
 #if F_CPU > 8000000L
 // the time to slow down for the displays
 // if your displays don't display the images 100% correct after
@@ -1,17 +1,31 @@
 #include "./FreeDeck.h"
 
+#include <EEPROM.h>
 #include <HID-Project.h>
 #include <SPI.h>
 #include <SdFat.h>
 #include <avr/power.h>
+#include <util/crc16.h>
 
 #include "../settings.h"
 #include "./Button.h"
+#include "./MemoryFree.h"
 #include "./OledTurboLight.h"
+#include "./Profiler.h"
 
 #define TYPE_DISPLAY 0
 #define TYPE_BUTTON 1
 
+// a display frame is sent and compared in bands of 8 pixel rows
+#define BAND_SIZE 128
+#define BAND_COUNT (1024 / BAND_SIZE)
+#define NO_IMAGE 0
+#define NO_CELL 0xffffffffUL
+
+#if IMG_CACHE_SIZE % BAND_SIZE != 0
+#error "IMG_CACHE_SIZE has to be a multiple of 128"
+#endif
+
 SdFat SD;
 File configFile;
 Button buttons[BD_COUNT];
@@ -21,15 +35,54 @@ uint16_t currentPage = 0;
 uint16_t nextPage = 0;
 uint16_t pageCount;
 uint16_t timeout_sec = TIMEOUT_TIME;
-unsigned short int fileImageDataOffset = 0;
+uint32_t fileImageDataOffset = 0;
 uint8_t contrast = 0;
 unsigned char imageCache[IMG_CACHE_SIZE];
+// what every display currently shows, to skip unchanged images and bands
+uint32_t shownImage[BD_COUNT];
+uint16_t bandCrc[BD_COUNT][BAND_COUNT];
+uint8_t validBands[BD_COUNT] = {0};
+bool bandStreaming = false;
+// PackBits decoder state, kept between the chunks of one image
+uint8_t packRun = 0;
+bool packRepeat = false;
+uint8_t packValue;
 uint8_t oled_delay = I2C_DELAY;
 uint8_t pre_charge_period = PRE_CHARGE_PERIOD;
 uint8_t refresh_frequency = REFRESH_FREQUENCY;
 bool woke_display = 0;
-uint8_t pressed_keys[ROW_SIZE - 3] = {0};
+bool screensOff = false;
+uint8_t held_keys[256 / 8] = {0};  // one bit per keycode
+// debounced button states, one bit per button, 1 is up
+#define BUTTON_MASK ((uint16_t)((1UL << BD_COUNT) - 1))
+uint16_t debouncedState = 0xffff;
 bool has_json = 0;
+// actions of the current page, [button][secondary]
+ButtonAction actions[BD_COUNT][2];
+ButtonAction *payloadAction = &actions[0][0];
+uint8_t payloadIndex = 0;
+uint32_t payloadPosition = 0;
+// keyboard macros waiting to be typed by macroTask
+Macro macros[MACRO_QUEUE_SIZE];
+uint8_t macroHead = 0;
+uint8_t macroCount = 0;
+uint16_t releasesDue = 0;  // buttons with queued keys, a slot is kept for their release
+unsigned long macroDue = 0;
+uint8_t textKey = 0;        // key of a text macro waiting to be released
+uint8_t textModifiers = 0;  // modifiers pressed by a text macro, bit 0 is 224
+uint8_t formatFlags = 0;
+uint8_t activeProfile = 0;
+uint32_t configFirstBlock = 0;  // first sd block of a contiguous config file
+uint32_t cachedBlock = 0;       // block of it that is in the sd cache, 0 for none
+// image locations of the pages the navigation buttons lead to
+uint16_t prefetchPage[PREFETCH_PAGES];
+uint32_t prefetchLocation[PREFETCH_PAGES][BD_COUNT];
+uint8_t prefetchCount[PREFETCH_PAGES];  // locations looked up so far
+uint8_t prefetchPages = 0;
+uint32_t warmCell = NO_CELL;  // (page, button) cell whose image is in the sd cache
+uint16_t settlingButtons = 0;  // buttons going down, not debounced yet
+
+uint8_t muxAddress = 0xff;  // what the multiplexer is switched to
 
 #ifdef CUSTOM_ORDER
 byte addressToScreen[] = ADDRESS_TO_SCREEN;
@@ -39,17 +92,67 @@ byte addressToButton[] = ADDRESS_TO_BUTTON;
 unsigned long last_action;
 unsigned long last_human_action;
 
+uint16_t debounceCount0 = 0xffff;
+uint16_t debounceCount1 = 0xffff;
+ButtonEvent buttonEvents[EVENT_QUEUE_SIZE];
+uint8_t eventHead = 0;
+uint8_t eventCount = 0;
+unsigned long lastScan = 0;
+unsigned long scanRateSince = 0;
+uint16_t scanCount = 0;
+uint16_t scanRate = 0;
+unsigned long maxButtonLatency = 0;
+unsigned long eventTime = 0;  // micros of the button event being handled, 0 for none
+unsigned long bootTimes[BOOT_PHASES] = {0};  // microseconds since reset
+// timing of the last page redraw in microseconds
+unsigned long redrawFirst = 0;
+unsigned long redrawTotal = 0;
+uint8_t redrawCount = 0;
+
+// ram of the big buffers, configFile and the upload file of the serial api
+#define DISPLAY_RAM (sizeof(shownImage) + sizeof(bandCrc) + sizeof(validBands))
+#define ACTION_RAM \
+  (sizeof(buttons) + sizeof(actions) + sizeof(macros) + sizeof(buttonEvents) + sizeof(held_keys))
+#define PREFETCH_RAM (sizeof(prefetchPage) + sizeof(prefetchLocation) + sizeof(prefetchCount))
+#define BUFFER_RAM                                                                              \
+  (sizeof(SD) + 2 * sizeof(File) + IMG_CACHE_SIZE + DISPLAY_RAM + ACTION_RAM + PREFETCH_RAM + \
+   PROFILER_RAM)
+static_assert(BUFFER_RAM <= RAM_BUDGET,
+              "buffers exceed RAM_BUDGET, lower IMG_CACHE_SIZE or PREFETCH_PAGES");
+
+uint16_t crc16(uint16_t crc, const uint8_t *data, uint16_t len) {
+  while (len--) {
+    crc = _crc_xmodem_update(crc, *data++);
+  }
+  return crc;
+}
+
+void invalidateDisplay(uint8_t display) {
+  shownImage[display] = NO_IMAGE;
+  validBands[display] = 0;
+}
+
+// the display shows data from serial now, its bands stay valid
+void forgetImage(uint8_t display) {
+  shownImage[display] = NO_IMAGE;
+}
+
 int getBitValue(int number, int place) {
   return (number & (1 << place)) >> place;
 }
 
 void setMuxAddress(uint8_t address, uint8_t type = TYPE_DISPLAY) {
+  if (type == TYPE_DISPLAY)
+    oledSelect(address);
 #ifdef CUSTOM_ORDER
   if (type == TYPE_DISPLAY)
     address = addressToScreen[address];
   else if (type == TYPE_BUTTON)
     address = addressToButton[address];
 #endif
+  if (address == muxAddress)
+    return;
+  muxAddress = address;
   int S0 = getBitValue(address, 0);
   digitalWrite(S0_PIN, S0);
 
@@ -68,12 +171,13 @@ void setMuxAddress(uint8_t address, uint8_t type = TYPE_DISPLAY) {
   digitalWrite(S3_PIN, S3);
 #endif
 
-  delay(1);  // wait for multiplexer to switch
+  // wait for multiplexer to switch
+  delayMicroseconds(type == TYPE_DISPLAY ? DISPLAY_MUX_SETTLE_US : MUX_SETTLE_US);
 }
 
 void loadPage(uint16_t pageIndex, bool force_load_images) {
   currentPage = pageIndex;
-  load_images(pageIndex, force_load_images);
+  load_images(pageIndex, force_load_images, BD_COUNT);
   load_buttons(pageIndex);
 }
 
@@ -83,7 +187,6 @@ void setGlobalContrast(unsigned short c) {
   contrast = c;
   for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
     setMuxAddress(buttonIndex, TYPE_DISPLAY);
-    delay(1);
     oledSetContrast(c);
   }
 }
@@ -102,8 +205,7 @@ bool wake_display_if_needed() {
 }
 
 void setSetting() {
-  uint8_t settingCommand;
-  configFile.read(&settingCommand, 1);
+  uint8_t settingCommand = readPayload();
   if (settingCommand == 1) {  // decrease brightness
     contrast = max(contrast - 20, 1);
     setGlobalContrast(contrast);
@@ -112,56 +214,183 @@ void setSetting() {
     setGlobalContrast(contrast);
   } else if (settingCommand == 3) {  // set brightness
     contrast = min(contrast + 20, 255);
-    setGlobalContrast(configFile.read());
+    setGlobalContrast(readPayload());
   }
 }
 
 bool key_is_pressed(uint8_t key) {
-  uint8_t count = 0;
-  for (uint8_t i = 0; i < ROW_SIZE - 3; i++) {
-    if (pressed_keys[i] == key) count++;
-  }
-  return count % 2;
+  return held_keys[key >> 3] & (1 << (key & 7));
 }
 
-void press_keys() {
-  byte i = 0;
-  uint8_t key;
-  configFile.read(&key, 1);
-  while (key != 0 && i < ROW_SIZE - 3) {
-    if (key_is_pressed(key)) {
-      Keyboard.release(KeyboardKeycode(key));
-      delay(15);
-    } else {
-      Keyboard.press(KeyboardKeycode(key));
-    }
-    pressed_keys[i] = key;
-    configFile.read(&key, 1);
-    delay(1);
-    i++;
+void toggle_key(uint8_t key) {
+  held_keys[key >> 3] ^= 1 << (key & 7);
+}
+
+bool keys_held() {
+  for (uint8_t i = 0; i < sizeof(held_keys); i++) {
+    if (held_keys[i])
+      return true;
   }
+  return false;
 }
 
 void release_keys() {
   Keyboard.releaseAll();
-  for (uint8_t i = 0; i < ROW_SIZE - 3; i++) {
-    pressed_keys[i] = 0;
+  memset(held_keys, 0, sizeof(held_keys));
+  textModifiers = 0;
+}
+
+// release what a text macro typed, but keep keys other buttons hold
+void release_text_keys() {
+  if (textKey && textKey < 224 && !key_is_pressed(textKey))
+    Keyboard.release(KeyboardKeycode(textKey));
+  for (uint8_t modifier = 0; modifier < 8; modifier++) {
+    if ((textModifiers & (1 << modifier)) && !key_is_pressed(224 + modifier))
+      Keyboard.release(KeyboardKeycode(224 + modifier));
+  }
+  textModifiers = 0;
+}
+
+// A keyboard or consumer report for a button event went out, the time since
+// the event counts for the slowest button handling. since is 0 afterwards
+void reportSent(unsigned long *since) {
+  if (*since == 0)
+    return;
+  unsigned long latency = micros() - *since;
+  if (latency > maxButtonLatency)
+    maxButtonLatency = latency;
+  *since = 0;
+}
+
+// free slots of the macro queue, without the ones kept for releases
+uint8_t macroRoom() {
+  uint8_t room = MACRO_QUEUE_SIZE - macroCount;
+  for (uint16_t due = releasesDue; due; due &= due - 1) {
+    room--;
+  }
+  return room;
+}
+
+// Set up a macro, its payload is read like readPayload would,
+// but only when the macro gets to it
+void initMacro(Macro *macro, uint8_t type, uint8_t interval) {
+  macro->type = type;
+  macro->interval = interval;
+  macro->count = 0;
+  macro->length = payloadAction->payloadLength;
+  macro->arg = payloadAction->arg;
+  macro->position = payloadPosition;
+  macro->since = eventTime;
+}
+
+void queueMacro(uint8_t type, uint8_t interval) {
+  initMacro(&macros[(macroHead + macroCount++) % MACRO_QUEUE_SIZE], type, interval);
+}
+
+uint8_t readMacroByte(Macro *macro) {
+  uint8_t index = macro->count++;
+  if (macro->length != PAYLOAD_LONG)
+    return index < macro->length ? macro->arg >> (8 * index) : 0;
+  forgetConfigBlock();
+  if (configFile.curPosition() != macro->position + index)
+    configFile.seekSet(macro->position + index);
+  return configFile.read();
+}
+
+// keys are only pressed with room for their release, a dropped release
+// would leave them held
+void press_keys(uint8_t buttonIndex) {
+  if (macroRoom() < 2)
+    return;
+  queueMacro(MACRO_KEYS, 0);
+  releasesDue |= 1 << buttonIndex;
+}
+
+void release_button_keys(uint8_t buttonIndex) {
+  if (releasesDue & (1 << buttonIndex)) {
+    releasesDue &= ~(1 << buttonIndex);
+    queueMacro(MACRO_RELEASE, 0);  // into the slot kept for it
+    return;
   }
+  // no keys of this button are queued, so they can be released right away
+  Macro release;
+  initMacro(&release, MACRO_RELEASE, 0);
+  releaseMacroKeys(&release);
+  reportSent(&release.since);
 }
 
 void sendText() {
-  byte i = 0;
+  if (macroRoom() == 0)
+    return;
+  // the upper nibble of the command sets the time per character
+  uint8_t speed = payloadAction->command >> 4;
+  queueMacro(MACRO_TEXT, speed ? speed * 4 : TEXT_CHAR_DELAY);
+}
+
+void finishMacro() {
+  macroHead = (macroHead + 1) % MACRO_QUEUE_SIZE;
+  macroCount--;
+}
+
+// release the keys of a button only, so chords over several buttons
+// work. once no button is down anymore nothing can be held
+void releaseMacroKeys(Macro *macro) {
   uint8_t key;
-  configFile.read(&key, 1);
-  while (key != 0 && i++ < ROW_SIZE - 1) {
-    Keyboard.press(KeyboardKeycode(key));
-    delay(8);
-    if (key < 224) {
-      Keyboard.releaseAll();
+  while (macro->count < ROW_SIZE - 3 && (key = readMacroByte(macro))) {
+    if (key_is_pressed(key)) {
+      Keyboard.release(KeyboardKeycode(key));
+      toggle_key(key);
     }
-    configFile.read(&key, 1);
   }
-  Keyboard.releaseAll();
+  if ((debouncedState & BUTTON_MASK) == BUTTON_MASK)
+    release_keys();
+}
+
+// Run the next due step of the queued macros, called from the main loop
+void macroTask() {
+  PROFILE(PROBE_MACROS);
+  unsigned long now = millis();
+  if (macroCount == 0 || (long)(now - macroDue) < 0)
+    return;
+  Macro *macro = &macros[macroHead];
+  if (macro->type == MACRO_RELEASE) {
+    releaseMacroKeys(macro);
+    reportSent(&macro->since);
+    finishMacro();
+    return;
+  }
+  if (macro->type == MACRO_TEXT && textKey) {
+    // like before a modifier applies to the next character only
+    if (textKey < 224)
+      release_text_keys();
+    textKey = 0;
+  }
+  uint8_t limit = macro->type == MACRO_TEXT ? ROW_SIZE - 1 : ROW_SIZE - 3;
+  uint8_t key = macro->count < limit ? readMacroByte(macro) : 0;
+  if (key == 0) {
+    if (macro->type == MACRO_TEXT)
+      release_text_keys();
+    finishMacro();
+    return;
+  }
+  if (macro->type == MACRO_TEXT) {
+    Keyboard.press(KeyboardKeycode(key));
+    textKey = key;
+    if (key >= 224)
+      textModifiers |= 1 << (key - 224);
+    reportSent(&macro->since);
+    macroDue = now + macro->interval;
+    return;
+  }
+  if (key_is_pressed(key)) {
+    Keyboard.release(KeyboardKeycode(key));
+    macroDue = now + 16;
+  } else {
+    Keyboard.press(KeyboardKeycode(key));
+    macroDue = now + 1;
+  }
+  reportSent(&macro->since);
+  toggle_key(key);
 }
 
 void emit_button_press(uint8_t button_index, bool secondary) {
@@ -182,39 +411,354 @@ void emit_page_change(uint16_t page_index) {
   Serial.println(page_index);
 }
 
-uint16_t get_target_page(uint8_t buttonIndex, uint8_t secondary) {
-  configFile.seekSet((BD_COUNT * currentPage + buttonIndex + 1) * ROW_SIZE + (ROW_SIZE / 2) * secondary + 1);
-  uint16_t pageIndex;
-  configFile.read(&pageIndex, 2);
-  return pageIndex;
-}
-
 void pressSpecialKey() {
-  uint16_t key;
-  configFile.read(&key, 2);
+  uint16_t key = readPayload();
+  key |= readPayload() << 8;
   Consumer.press((ConsumerKeycode)key);
+  reportSent(&eventTime);
 }
 
-void displayImage(uint16_t imageNumber, bool force) {
-  configFile.seekSet(fileImageDataOffset + imageNumber * 1025L);
+uint8_t prefetchSlot(uint16_t pageIndex) {
+  uint8_t slot = 0;
+  while (slot < prefetchPages && prefetchPage[slot] != pageIndex)
+    slot++;
+  return slot < prefetchPages ? slot : PREFETCH_PAGES;
+}
+
+// Collect the pages the navigation buttons of the current page lead to
+void planPrefetch() {
+  prefetchPages = 0;
+  warmCell = NO_CELL;
+  for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
+    for (uint8_t secondary = 0; secondary < 2; secondary++) {
+      ButtonAction *action = &actions[buttonIndex][secondary];
+      if ((action->command & 0xf) != 1 || action->arg >= pageCount || prefetchSlot(action->arg) < PREFETCH_PAGES)
+        continue;
+      if (prefetchPages == PREFETCH_PAGES)
+        return;
+      prefetchPage[prefetchPages] = action->arg;
+      prefetchCount[prefetchPages++] = 0;
+    }
+  }
+}
+
+// Look up the image locations of one navigation target per call while the
+// main loop is idle. then read the image the pressed display shows on the
+// page a button going down leads to into the sd cache, load_images draws that
+// display first and can start right away
+void prefetchTask() {
+  PROFILE(PROBE_PREFETCH);
+  if (macroCount || eventCount || Serial.available() > 0)
+    return;
+  for (uint8_t slot = 0; slot < prefetchPages; slot++) {
+    if (prefetchCount[slot] == BD_COUNT)
+      continue;
+    // a failed lookup is tried again in the next idle loop
+    if ((formatFlags & FORMAT_IMAGE_TABLE) && !pageLocations(prefetchPage[slot], prefetchLocation[slot]))
+      return;
+    prefetchCount[slot] = BD_COUNT;
+    return;
+  }
+  // without a button going down display 0 is drawn first
+  uint32_t cell = prefetchPages ? (uint32_t)prefetchPage[0] * BD_COUNT : NO_CELL;
+  for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
+    ButtonAction *action = &actions[buttonIndex][false];
+    if ((settlingButtons & (1 << buttonIndex)) && (action->command & 0xf) == 1 && prefetchSlot(action->arg) < PREFETCH_PAGES)
+      cell = (uint32_t)action->arg * BD_COUNT + buttonIndex;
+  }
+  if (cell == NO_CELL || cell == warmCell)
+    return;
+  warmCell = cell;
+  uint8_t first;
+  readConfig(imageLocation(cell) & 0x7fffffffL, &first, 1);
+}
+
+// The sd library's sector cache holding a block of a contiguous config. it is
+// read with a raw single block read unless it is there already, so the rows,
+// image table entries and live data flags sharing a block cost one read.
+// NULL if it could not be read
+uint8_t *configBlock(uint32_t block) {
+  uint8_t *sector = SD.vol()->cacheClear()->data;
+  if (block == cachedBlock)
+    return sector;
+  cachedBlock = 0;
+  bool read = SD.card()->readStart(block) && readSector(sector);
+  SD.card()->readStop();
+  if (!read)
+    return NULL;
+  cachedBlock = block;
+  return sector;
+}
+
+// The sd library used its cache for something else, or the config changed
+void forgetConfigBlock() {
+  cachedBlock = 0;
+}
+
+// Read len bytes of the config at position. a contiguous config is read
+// through configBlock, which costs the same for any position. seeking in
+// other files follows their cluster chain.
+// false if the sd card could not deliver all of it
+bool readConfig(uint32_t position, void *data, uint16_t len) {
+  PROFILE(PROBE_SD);
+  if (!configFirstBlock)
+    return configFile.seekSet(position) && configFile.read(data, len) == len;
+  uint8_t *out = (uint8_t *)data;
+  while (len) {
+    uint8_t *sector = configBlock(configFirstBlock + position / 512);
+    if (!sector)
+      return false;
+    uint16_t n = min(512 - position % 512, len);
+    memcpy(out, sector + position % 512, n);
+    out += n;
+    position += n;
+    len -= n;
+  }
+  return true;
+}
+
+// file offset of the image shown by a (page, button) cell
+uint32_t imageLocation(uint32_t imageNumber) {
+  if (!(formatFlags & FORMAT_IMAGE_TABLE))
+    return fileImageDataOffset + imageNumber * 1025L;
+  uint8_t slot = prefetchSlot(imageNumber / BD_COUNT);
+  uint8_t display = imageNumber % BD_COUNT;
+  if (slot < PREFETCH_PAGES && display < prefetchCount[slot])
+    return prefetchLocation[slot][display];
+  uint32_t location;
+  if (!readConfig(fileImageDataOffset + imageNumber * 4, &location, 4))
+    return NO_IMAGE;
+  return location;
+}
+
+// image locations of every cell of a page, the image table is read at once.
+// false if it could not be read, the locations are NO_IMAGE then
+bool pageLocations(uint16_t pageIndex, uint32_t *locations) {
+  uint32_t first = (uint32_t)pageIndex * BD_COUNT;
+  uint8_t slot = prefetchSlot(pageIndex);
+  if ((formatFlags & FORMAT_IMAGE_TABLE) && (slot == PREFETCH_PAGES || prefetchCount[slot] < BD_COUNT)) {
+    if (readConfig(fileImageDataOffset + first * 4, locations, BD_COUNT * 4))
+      return true;
+    for (uint8_t display = 0; display < BD_COUNT; display++) {
+      locations[display] = NO_IMAGE;
+    }
+    return false;
+  }
+  for (uint8_t display = 0; display < BD_COUNT; display++) {
+    locations[display] = imageLocation(first + display);
+  }
+  return true;
+}
+
+// Decode the next len bytes of a PackBits compressed image
+// straight from the config file, without a frame buffer
+void unpackImageData(uint8_t *out, uint16_t len) {
+  while (len) {
+    if (packRun == 0) {
+      int8_t header = configFile.read();
+      if (header == -128)  // no-op
+        continue;
+      packRepeat = header < 0;
+      if (packRepeat) {
+        packRun = 1 - header;
+        packValue = configFile.read();
+      } else {
+        packRun = header + 1;
+      }
+    }
+    uint8_t n = min(packRun, len);
+    if (packRepeat)
+      memset(out, packValue, n);
+    else
+      configFile.read(out, n);
+    out += n;
+    len -= n;
+    packRun -= n;
+  }
+}
+
+// Send the bands of data that differ from what the display already shows,
+// consecutive changed bands share one i2c transaction until drawBandsEnd
+void drawBands(uint8_t display, uint8_t *data, uint8_t band, uint8_t count) {
+  for (; count; count--, band++, data += BAND_SIZE) {
+    uint16_t crc = crc16(0xffff, data, BAND_SIZE);
+    if ((validBands[display] & (1 << band)) && bandCrc[display][band] == crc) {
+      drawBandsEnd();
+      continue;
+    }
+    if (!bandStreaming)
+      oledDataBegin(band * BAND_SIZE);
+    bandStreaming = true;
+    oledDataPush(data, BAND_SIZE);
+    bandCrc[display][band] = crc;
+    validBands[display] |= 1 << band;
+  }
+}
+
+void drawBandsEnd() {
+  if (bandStreaming)
+    oledDataEnd();
+  bandStreaming = false;
+}
+
+// Draw a chunk of an image on every display in the mask. a single display
+// keeps its i2c transaction open for the next chunk
+void drawChunk(uint16_t displays, uint8_t *data, uint8_t band, uint8_t count) {
+  bool single = !(displays & (displays - 1));
+  for (uint8_t display = 0; displays; display++, displays >>= 1) {
+    if (!(displays & 1))
+      continue;
+    setMuxAddress(display, TYPE_DISPLAY);
+    drawBands(display, data, band, count);
+    if (!single)
+      drawBandsEnd();
+  }
+}
+
+bool readSector(uint8_t *sector) {
+  PROFILE(PROBE_SD);
+  return SD.card()->readData(sector);
+}
+
+// Stream an image of a contiguous config with a multi block read, using the
+// sd library's sector cache as buffer. its first block is taken from there
+// if reading the live data flag left it. sector aligned images are drawn
+// straight from the cache, others are put together band by band in imageCache
+bool displayImageBlocks(uint16_t displays, uint32_t location) {
+  uint8_t *sector = SD.vol()->cacheClear()->data;
+  uint32_t block = configFirstBlock + location / 512;
+  uint16_t skip = location % 512;
+  bool cachedFirst = block == cachedBlock;
+  bool streaming = false;
+  cachedBlock = 0;
+  uint16_t drawn = 0;
+  uint8_t cached = 0;
+  for (; drawn < 1024; block++, skip = 0) {
+    if (cachedFirst) {
+      cachedFirst = false;
+    } else {
+      if (!streaming && !SD.card()->readStart(block))
+        break;
+      streaming = true;
+      if (!readSector(sector))
+        break;
+    }
+    if (skip == 0 && cached == 0 && drawn <= 1024 - 512) {
+      drawChunk(displays, sector, drawn / BAND_SIZE, 512 / BAND_SIZE);
+      drawn += 512;
+      continue;
+    }
+    for (uint16_t i = skip; i < 512 && drawn < 1024;) {
+      uint8_t n = min(512 - i, BAND_SIZE - cached);
+      memcpy(imageCache + cached, sector + i, n);
+      cached += n;
+      i += n;
+      if (cached == BAND_SIZE) {
+        drawChunk(displays, imageCache, drawn / BAND_SIZE, 1);
+        drawn += BAND_SIZE;
+        cached = 0;
+      }
+    }
+  }
+  drawBandsEnd();
+  if (streaming)
+    SD.card()->readStop();
+  if (drawn < 1024)  // a partly drawn image is drawn again from the file
+    return false;
+  cachedBlock = block - 1;  // the last block read stays in the sd cache
+  return true;
+}
+
+// the location of an image like shownImage holds it, without the live data flag
+uint32_t shownLocation(uint32_t location) {
+  if (formatFlags & FORMAT_SECTOR_ALIGNED)
+    location &= 0x7fffffffL;
+  return location;
+}
+
+void displayImage(uint8_t display, uint32_t imageNumber, bool force) {
+  displayImages(1 << display, imageLocation(imageNumber), force);
+}
+
+// Draw the image at location (an imageLocation) on every display in the mask.
+// it is read from the sd card once and every chunk goes to all of them
+void displayImages(uint16_t displays, uint32_t location, bool force) {
+  PROFILE(PROBE_DISPLAY);
+  bool aligned = formatFlags & FORMAT_SECTOR_ALIGNED;
   uint8_t has_live_data;
-  has_live_data = configFile.read();
+  if (aligned) {
+    // the live data flag is the top bit of the image table entry
+    has_live_data = location >> 31;
+    location &= 0x7fffffffL;
+  }
+  if (location == NO_IMAGE)  // the image table could not be read
+    return;
+  for (uint8_t display = 0; display < BD_COUNT; display++) {
+    if (shownImage[display] == location)
+      displays &= ~(1 << display);
+  }
+  if (!displays)
+    return;
+  if (!aligned && !readConfig(location, &has_live_data, 1))
+    return;
   if (!force && has_live_data == 1 && (millis() - last_data_received) < 2000)
     return;
-  configFile.seekSet(fileImageDataOffset + imageNumber * 1025L);
+  // compressed images have to be decoded from the file
+  bool packed = (formatFlags & FORMAT_PACKBITS) && !aligned;
+  if (packed || !configFirstBlock || !displayImageBlocks(displays, location)) {
+    displayImageChunks(displays, location, aligned);
+  }
+  for (uint8_t display = 0; display < BD_COUNT; display++) {
+    if (displays & (1 << display))
+      shownImage[display] = location;
+  }
+}
+
+void displayImageChunks(uint16_t displays, uint32_t location, bool aligned) {
+  forgetConfigBlock();
+  // compressed images start right after the live data byte
+  bool packed = (formatFlags & FORMAT_PACKBITS) && !aligned;
+  configFile.seekSet(packed ? location + 1 : location);
+  packRun = 0;
   uint8_t byteI = 0;
   while (configFile.available() && byteI < (1024 / IMG_CACHE_SIZE)) {
-    configFile.read(imageCache, IMG_CACHE_SIZE);
-    oledLoadBMPPart(imageCache, IMG_CACHE_SIZE, byteI * IMG_CACHE_SIZE);
+    {
+      PROFILE(PROBE_SD);
+      if (packed)
+        unpackImageData(imageCache, IMG_CACHE_SIZE);
+      else
+        configFile.read(imageCache, IMG_CACHE_SIZE);
+    }
+    drawChunk(displays, imageCache, byteI * (IMG_CACHE_SIZE / BAND_SIZE), IMG_CACHE_SIZE / BAND_SIZE);
     byteI++;
   }
+  drawBandsEnd();
 }
 
-uint8_t getCommand(uint8_t button, uint8_t secondary) {
-  configFile.seek((BD_COUNT * currentPage + button + 1) * ROW_SIZE + (ROW_SIZE / 2) * secondary);
-  uint8_t command;
-  command = configFile.read();
-  return command;
+// file offset of the primary or secondary half of a button row
+uint32_t rowOffset(uint16_t pageIndex, uint8_t button, uint8_t secondary) {
+  return (BD_COUNT * (uint32_t)pageIndex + button + 1) * ROW_SIZE + (ROW_SIZE / 2) * secondary;
+}
+
+// Point readPayload at the payload of a button action,
+// short payloads come from the action table instead of the sd card
+void openPayload(uint8_t button, uint8_t secondary) {
+  payloadAction = &actions[button][secondary];
+  payloadIndex = 0;
+  payloadPosition = rowOffset(currentPage, button, secondary) + 1;
+  if (payloadAction->payloadLength == PAYLOAD_LONG) {
+    forgetConfigBlock();
+    configFile.seekSet(payloadPosition);
+    warmCell = NO_CELL;  // the payload replaces it in the sd cache
+  }
+}
+
+uint8_t readPayload() {
+  if (payloadAction->payloadLength == PAYLOAD_LONG)
+    return configFile.read();
+  if (payloadIndex >= payloadAction->payloadLength)
+    return 0;
+  return payloadAction->arg >> (8 * payloadIndex++);
 }
 
 void onButtonPress(uint8_t button_index, uint8_t secondary) {
@@ -222,12 +766,14 @@ void onButtonPress(uint8_t button_index, uint8_t secondary) {
   woke_display = wake_display_if_needed();
   if (woke_display)
     return;
-  uint8_t command = getCommand(button_index, secondary) & 0xf;
+  ButtonAction *action = &actions[button_index][secondary];
+  uint8_t command = action->command & 0xf;
+  openPayload(button_index, secondary);
   if (command == 0) {
-    press_keys();
+    press_keys(button_index);
   } else if (command == 1) {
-    nextPage = get_target_page(button_index, secondary);
-    load_images(nextPage, false);
+    nextPage = action->arg;
+    load_images(nextPage, false, button_index);
   } else if (command == 3) {
     pressSpecialKey();
   } else if (command == 4) {
@@ -245,49 +791,191 @@ void onButtonRelease(uint8_t buttonIndex, uint8_t secondary) {
     woke_display = false;
     return;
   }
-  uint8_t command = getCommand(buttonIndex, secondary) & 0xf;
+  uint8_t command = actions[buttonIndex][secondary].command & 0xf;
   if (command == 0) {
-    release_keys();
+    openPayload(buttonIndex, secondary);
+    release_button_keys(buttonIndex);
   } else if (command == 1) {
     currentPage = nextPage;
     load_buttons(currentPage);
   } else if (command == 3) {
     Consumer.releaseAll();
+    reportSent(&eventTime);
   }
+  releasesDue &= ~(1 << buttonIndex);  // the page changed under a held key button
   // check if leave is wanted
-  configFile.seek((BD_COUNT * currentPage + buttonIndex + 1) * ROW_SIZE + (ROW_SIZE / (2 - secondary)) - 2);
-  uint16_t page_index;
-  configFile.read(&page_index, 2);
+  uint16_t page_index = actions[buttonIndex][secondary].leave;
   if (page_index > 0) {
     loadPage(page_index - 1, false);
   }
 }
 
-void load_images(uint16_t pageIndex, bool force) {
+// Draw the images of a page. the display of the pressed button (BD_COUNT for
+// none) goes first as the user looks at it, displays that keep their image
+// are skipped without switching the multiplexer to them. displays showing
+// the same image are drawn together
+void load_images(uint16_t pageIndex, bool force, uint8_t pressed) {
   emit_page_change(pageIndex);
-  for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
-    setMuxAddress(buttonIndex, TYPE_DISPLAY);
-    displayImage(pageIndex * BD_COUNT + buttonIndex, force);
+  unsigned long start = micros();
+  uint32_t locations[BD_COUNT];
+  uint16_t pending = 0;
+  pageLocations(pageIndex, locations);
+  for (uint8_t display = 0; display < BD_COUNT; display++) {
+    if (shownImage[display] != shownLocation(locations[display]))
+      pending |= 1 << display;
+  }
+  redrawCount = 0;
+  redrawFirst = 0;
+  for (uint8_t i = 0; i <= BD_COUNT; i++) {
+    uint8_t display = i == 0 ? pressed : i - 1;
+    if (display >= BD_COUNT || !(pending & (1 << display)))
+      continue;
+    uint16_t group = 0;
+    for (uint8_t other = 0; other < BD_COUNT; other++) {
+      if ((pending & (1 << other)) && locations[other] == locations[display]) {
+        group |= 1 << other;
+        redrawCount++;
+      }
+    }
+    pending &= ~group;
+    displayImages(group, locations[display], force);
+    if (redrawFirst == 0)
+      redrawFirst = micros() - start;
+  }
+  redrawTotal = micros() - start;
+}
+
+// Read everything a press or release needs into the action table,
+// so handling a button does not have to touch the sd card
+void load_action(uint8_t buttonIndex, uint8_t secondary, const uint8_t *row) {
+  ButtonAction *action = &actions[buttonIndex][secondary];
+  memcpy(&action->leave, row + ROW_SIZE / 2 - 2, 2);
+  action->command = row[0];
+  action->arg = row[1] | row[2] << 8;
+  uint8_t command = row[0] & 0xf;
+  if (command == 3 || command == 5) {  // always two bytes
+    action->payloadLength = 2;
+  } else if (command == 0 || command == 4) {  // zero terminated keys
+    action->payloadLength = row[1] == 0 ? 0 : row[2] == 0 ? 1 : row[3] == 0 ? 2 : PAYLOAD_LONG;
+  } else {
+    action->payloadLength = 0;
   }
 }
 
+void load_button(uint16_t pageIndex, uint8_t buttonIndex) {
+  // a row that can not be read does nothing
+  if (!readConfig(rowOffset(pageIndex, buttonIndex, false), imageCache, ROW_SIZE))
+    memset(imageCache, 0, ROW_SIZE);
+  load_action(buttonIndex, false, imageCache);
+  load_action(buttonIndex, true, imageCache + ROW_SIZE / 2);
+  buttons[buttonIndex].has_secondary = actions[buttonIndex][true].command != 2;
+  buttons[buttonIndex].onPressCallback = onButtonPress;  // to do: only do this initially
+  buttons[buttonIndex].onReleaseCallback = onButtonRelease;
+}
+
 void load_buttons(uint16_t pageIndex) {
   for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
-    uint8_t command = getCommand(buttonIndex, false);
-    uint8_t second_command = getCommand(buttonIndex, true);
-    buttons[buttonIndex].has_secondary = second_command != 2;
-    buttons[buttonIndex].onPressCallback = onButtonPress;  // to do: only do this initially
-    buttons[buttonIndex].onReleaseCallback = onButtonRelease;
+    load_button(pageIndex, buttonIndex);
+  }
+  planPrefetch();
+}
 
-    delay(1);
+// Overwrite a button row in place, a row on the current page takes effect at once
+void patchRow(uint16_t pageIndex, uint8_t buttonIndex, const uint8_t *row) {
+  forgetConfigBlock();
+  configFile.seekSet(rowOffset(pageIndex, buttonIndex, false));
+  configFile.write(row, ROW_SIZE);
+  configFile.sync();
+  if (pageIndex == currentPage) {
+    load_button(pageIndex, buttonIndex);
+    planPrefetch();  // the button may lead somewhere else now
+  }
+}
+
+// Overwrite one band of an image in place. if its display shows it,
+// it is redrawn and only the changed band goes over the wire. with an image
+// table every cell sharing the image gets the band
+bool patchImage(uint16_t pageIndex, uint8_t buttonIndex, uint8_t band, const uint8_t *data) {
+  // compressed images change their size
+  if ((formatFlags & FORMAT_PACKBITS) || band >= BAND_COUNT)
+    return false;
+  uint32_t imageNumber = (uint32_t)pageIndex * BD_COUNT + buttonIndex;
+  uint32_t location = shownLocation(imageLocation(imageNumber));
+  if (location == NO_IMAGE)  // the image table could not be read
+    return false;
+  forgetConfigBlock();
+  // the same bytes displayImage reads, the live data byte is the first one
+  configFile.seekSet(location + band * BAND_SIZE);
+  configFile.write(data, BAND_SIZE);
+  configFile.sync();
+  // every display showing the image gets the new band
+  uint16_t displays = 0;
+  for (uint8_t display = 0; display < BD_COUNT; display++) {
+    if (shownImage[display] == location) {
+      forgetImage(display);
+      displays |= 1 << display;
+    }
+  }
+  if (displays)
+    displayImages(displays, imageLocation(imageNumber), true);
+  return true;
+}
+
+// Sample all buttons and debounce them with two bit vertical counters,
+// a button changes state after 4 equal samples in a row
+void scanButtons() {
+  PROFILE(PROBE_SCAN);
+  uint16_t sample = ~BUTTON_MASK;  // unused bits always read up
+  for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
+    setMuxAddress(buttonIndex, TYPE_BUTTON);
+    if (digitalRead(BUTTON_PIN))
+      sample |= 1 << buttonIndex;
   }
+  uint16_t delta = debouncedState ^ sample;
+  debounceCount0 = ~(debounceCount0 & delta);
+  debounceCount1 = debounceCount0 ^ (debounceCount1 & delta);
+  uint16_t changed = delta & debounceCount0 & debounceCount1;
+  debouncedState ^= changed;
+  settlingButtons = debouncedState & ~sample & BUTTON_MASK;
+  unsigned long now = micros();
+  for (uint8_t buttonIndex = 0; changed; buttonIndex++, changed >>= 1) {
+    if (!(changed & 1) || eventCount == EVENT_QUEUE_SIZE)
+      continue;
+    uint8_t slot = (eventHead + eventCount++) % EVENT_QUEUE_SIZE;
+    buttonEvents[slot].button = buttonIndex;
+    buttonEvents[slot].time = now;
+  }
+  scanCount++;
 }
 
-void checkButtonState(uint8_t buttonIndex) {
-  setMuxAddress(buttonIndex, TYPE_BUTTON);
-  uint8_t state = digitalRead(BUTTON_PIN);
-  buttons[buttonIndex].update(state);
-  return;
+void buttonTask() {
+  PROFILE(PROBE_BUTTONS);
+  unsigned long now = micros();
+  if (now - lastScan >= SCAN_INTERVAL_US) {
+    lastScan = now;
+    scanButtons();
+  }
+  if (now - scanRateSince >= 1000000UL) {
+    scanRate = scanCount;
+    scanCount = 0;
+    scanRateSince = now;
+  }
+  while (eventCount) {
+    ButtonEvent *event = &buttonEvents[eventHead];
+    eventHead = (eventHead + 1) % EVENT_QUEUE_SIZE;
+    eventCount--;
+    eventTime = event->time;
+    buttons[event->button].update((debouncedState >> event->button) & 1);
+  }
+  eventTime = 0;
+  // keep the state machines running for long presses
+  for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
+    buttons[buttonIndex].update((debouncedState >> buttonIndex) & 1);
+  }
+  // a key button released on another page than it was pressed on does not
+  // know its keys anymore. once every button is up and typed nothing is held
+  if (!macroCount && (debouncedState & BUTTON_MASK) == BUTTON_MASK && keys_held())
+    release_keys();
 }
 
 void initAllDisplays(uint8_t _oled_delay, uint8_t _pre_charge_period, uint8_t _refresh_frequency) {
@@ -295,18 +983,66 @@ void initAllDisplays(uint8_t _oled_delay, uint8_t _pre_charge_period, uint8_t _r
   for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
     buttons[buttonIndex].index = buttonIndex;
     setMuxAddress(buttonIndex, TYPE_DISPLAY);
-    delay(1);
     oledInit(0x3c, _pre_charge_period, _refresh_frequency);
     oledFill(255);
+    oledTurnOn();
+    invalidateDisplay(buttonIndex);
   }
 }
 
+// Initialize every display once with the parameters of the config header
+// and draw its image of page 0, or clear it, before it is switched on
+void bootDisplays() {
+  if (contrast == 0)
+    contrast = 1;
+  currentPage = 0;
+  load_buttons(0);
+  bootTimes[BOOT_KEYS] = micros();
+  emit_page_change(0);
+  for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
+    buttons[buttonIndex].index = buttonIndex;
+    setMuxAddress(buttonIndex, TYPE_DISPLAY);
+    oledInit(0x3c, pre_charge_period, refresh_frequency);
+    oledSetContrast(contrast);
+    invalidateDisplay(buttonIndex);
+    displayImage(buttonIndex, buttonIndex, true);
+    // without an image the display ram holds whatever it powered up with
+    if (shownImage[buttonIndex] == NO_IMAGE)
+      oledFill(0);
+    oledTurnOn();
+    if (buttonIndex == 0)
+      bootTimes[BOOT_FIRST_IMAGE] = micros();
+  }
+  screensOff = false;
+  bootTimes[BOOT_IMAGES] = micros();
+}
+
+#if PROFILE_COUNT > 100
+#error "PROFILE_COUNT has to be at most 100, longer names do not fit 8.3"
+#endif
+
+// file name of a profile below PROFILE_COUNT, name needs PROFILE_NAME_SIZE bytes
+void profileName(uint8_t profile, char *name) {
+  if (profile == 0)
+    strcpy(name, CONFIG_NAME);
+  else
+    sprintf(name, PROFILE_NAME, profile);
+}
+
 void loadConfigFile() {
-  configFile = SD.open(CONFIG_NAME, FILE_READ);
+  char name[PROFILE_NAME_SIZE];
+  activeProfile = EEPROM.read(PROFILE_EEPROM_ADDRESS);
+  if (activeProfile >= PROFILE_COUNT)  // erased
+    activeProfile = 0;
+  profileName(activeProfile, name);
+  if (!SD.exists(name)) {
+    activeProfile = 0;
+    strcpy(name, CONFIG_NAME);
+  }
+  configFile = SD.open(name, O_RDWR);  // rows and images can be patched
   configFile.seek(2);
-  configFile.read(&fileImageDataOffset, 2);
-  pageCount = (fileImageDataOffset - 1) / BD_COUNT;
-  fileImageDataOffset = fileImageDataOffset * ROW_SIZE;
+  uint16_t imageDataRow = 0;
+  configFile.read(&imageDataRow, 2);
 
   // configFile.seekSet(4);
   configFile.read(&contrast, 1);
@@ -318,6 +1054,25 @@ void loadConfigFile() {
   configFile.read(&refresh_frequency, 1);
 
   configFile.read(&has_json, 1);
+  configFile.read(&formatFlags, 1);
+  if (formatFlags & FORMAT_HEADER_V2) {
+    // 32 bit image data offset in bytes, the page count is stored
+    fileImageDataOffset = 0;
+    configFile.seekSet(16);
+    configFile.read(&fileImageDataOffset, 4);
+    configFile.read(&pageCount, 2);
+  } else {
+    pageCount = (imageDataRow - 1) / BD_COUNT;
+    fileImageDataOffset = imageDataRow * (uint32_t)ROW_SIZE;
+  }
+  macroCount = 0;
+  releasesDue = 0;
+  prefetchPages = 0;
+
+  uint32_t lastBlock;
+  if (!configFile.contiguousRange(&configFirstBlock, &lastBlock))
+    configFirstBlock = 0;
+  forgetConfigBlock();
 
   if (oled_delay == 0)
     oled_delay = I2C_DELAY;
@@ -331,17 +1086,65 @@ void initSdCard() {
   while (!SD.begin(SD_CS_PIN, SD_SCK_MHZ(SD_MHZ))) {
     delay(1);
   }
+  bootTimes[BOOT_SD] = micros();
 }
 
-void postSetup() {
+// Make another profile active and remember it across power cycles. only its
+// header and page 0 are loaded, the displays are initialized again only if
+// the profile needs other display parameters
+bool switchProfile(uint8_t profile) {
+  char name[PROFILE_NAME_SIZE];
+  if (profile >= PROFILE_COUNT)
+    return false;
+  profileName(profile, name);
+  if (!SD.exists(name))
+    return false;
+  uint8_t previousPreCharge = pre_charge_period;
+  uint8_t previousRefresh = refresh_frequency;
+  EEPROM.update(PROFILE_EEPROM_ADDRESS, profile);
+  configFile.close();
   loadConfigFile();
-  initAllDisplays(oled_delay, pre_charge_period, refresh_frequency);
+  bootTimes[BOOT_CONFIG] = micros();
+  release_keys();
+  Consumer.releaseAll();
+  if (pre_charge_period != previousPreCharge || refresh_frequency != previousRefresh) {
+    bootDisplays();
+    return true;
+  }
+  // locations of the other file mean nothing, but the bands stay valid
+  for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
+    forgetImage(buttonIndex);
+  }
   setGlobalContrast(contrast);
   loadPage(0, true);
+  return true;
+}
+
+// free ram now, least free ram since boot, the sizes of the buffers in
+// BUFFER_RAM, their total and RAM_BUDGET
+void memoryReport(uint16_t *report) {
+  report[0] = freeMemory();
+  report[1] = minFreeStack();
+  report[2] = sizeof(SD);
+  report[3] = 2 * sizeof(File);
+  report[4] = IMG_CACHE_SIZE;
+  report[5] = DISPLAY_RAM;
+  report[6] = ACTION_RAM;
+  report[7] = PREFETCH_RAM;
+  report[8] = PROFILER_RAM;
+  report[9] = BUFFER_RAM;
+  report[10] = RAM_BUDGET;
+}
+
+void postSetup() {
+  loadConfigFile();
+  bootTimes[BOOT_CONFIG] = micros();
+  bootDisplays();
 }
 
 void sleepTask() {
-  if (timeout_sec == 0)
+  PROFILE(PROBE_SLEEP);
+  if (timeout_sec == 0 || screensOff)
     return;
   if (millis() - last_action >= (timeout_sec * 1000L)) {
     switchScreensOff();
@@ -351,16 +1154,16 @@ void sleepTask() {
 void switchScreensOff() {
   for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
     setMuxAddress(buttonIndex, TYPE_DISPLAY);
-    delay(1);
     oledShutdown();
   }
+  screensOff = true;
 }
 
 void switchScreensOn() {
   for (uint8_t buttonIndex = 0; buttonIndex < BD_COUNT; buttonIndex++) {
     setMuxAddress(buttonIndex, TYPE_DISPLAY);
-    delay(1);
     oledTurnOn();
   }
+  screensOff = false;
   last_action = millis();
 }
\ No newline at end of file
@@ -4,11 +4,69 @@
 #define TYPE_DISPLAY 0
 #define TYPE_BUTTON 1
 
+// bits of the format flags byte in the config header
+// the image data starts with a table of 32 bit file offsets, one per (page, button)
+#define FORMAT_IMAGE_TABLE 0x01
+// images are PackBits compressed, only valid together with FORMAT_IMAGE_TABLE
+#define FORMAT_PACKBITS 0x02
+// images are 1024 bytes at 512 byte sector boundaries, the live data flag is
+// the top bit of the image table entry. only valid together with FORMAT_IMAGE_TABLE
+#define FORMAT_SECTOR_ALIGNED 0x04
+// the header holds the image data offset in bytes (32 bit) and the page count
+#define FORMAT_HEADER_V2 0x08
+
+#define PAYLOAD_LONG 0xff
+#define PROFILE_NAME_SIZE 13  // 8.3 and the terminating 0
+
+// boot phases, bootTimes holds when each one was done
+#define BOOT_SD 0
+#define BOOT_CONFIG 1
+#define BOOT_KEYS 2
+#define BOOT_FIRST_IMAGE 3
+#define BOOT_IMAGES 4
+#define BOOT_PHASES 5
+
+// u16 entries of the memory report, see memoryReport
+#define MEMORY_REPORT_SIZE 11
+
+// what a button does, cached for the current page
+struct ButtonAction {
+  uint8_t command;
+  uint8_t payloadLength;  // bytes of the payload held in arg, or PAYLOAD_LONG
+  uint16_t arg;           // target page or the first two payload bytes
+  uint16_t leave;         // page to load after the release + 1, 0 for none
+};
+
+#define EVENT_QUEUE_SIZE 8
+
+// a debounced button state change, waiting to be handled by the main loop
+struct ButtonEvent {
+  uint8_t button;
+  unsigned long time;
+};
+
+#define MACRO_QUEUE_SIZE 4
+#define MACRO_KEYS 0
+#define MACRO_TEXT 1
+#define MACRO_RELEASE 2
+
+// a key or text macro being typed without blocking the main loop
+struct Macro {
+  uint8_t type;
+  uint8_t interval;  // ms between text characters
+  uint8_t count;     // payload bytes read so far
+  uint8_t length;    // like ButtonAction.payloadLength
+  uint16_t arg;
+  uint32_t position;    // file offset of a long payload
+  unsigned long since;  // micros of its button event, 0 once its first report is sent
+};
+
 extern uint16_t currentPage;
 extern uint16_t pageCount;
 extern uint16_t timeout_sec;
 extern uint32_t last_data_received;
 extern File configFile;
+extern unsigned char imageCache[];
 extern SdFat SD;
 extern unsigned long last_action;
 extern unsigned long last_human_action;
@@ -17,24 +75,78 @@ extern uint8_t oled_delay;
 extern uint8_t pre_charge_period;
 extern uint8_t refresh_frequency;
 extern bool has_json;
+extern uint16_t scanRate;
+extern unsigned long maxButtonLatency;
+extern unsigned long redrawFirst;
+extern unsigned long redrawTotal;
+extern uint8_t redrawCount;
+extern unsigned long bootTimes[];
+extern uint8_t formatFlags;
+extern uint8_t activeProfile;
+extern uint32_t configFirstBlock;
+uint16_t crc16(uint16_t crc, const uint8_t *data, uint16_t len);
+void invalidateDisplay(uint8_t display);
+void forgetImage(uint8_t display);
 int getBitValue(int number, int place);
 void setMuxAddress(uint8_t address, uint8_t type);
 void setGlobalContrast(unsigned short c);
 void setSetting();
-void press_keys();
+bool key_is_pressed(uint8_t key);
+void toggle_key(uint8_t key);
+bool keys_held();
+void release_keys();
+void release_text_keys();
+void reportSent(unsigned long *since);
+void queueMacro(uint8_t type, uint8_t interval);
+uint8_t readMacroByte(Macro *macro);
+uint8_t macroRoom();
+void initMacro(Macro *macro, uint8_t type, uint8_t interval);
+void press_keys(uint8_t buttonIndex);
+void release_button_keys(uint8_t buttonIndex);
+void releaseMacroKeys(Macro *macro);
 void sendText();
+void finishMacro();
+void macroTask();
 void pressSpecialKey();
-void displayImage(uint16_t imageNumber);
-void load_images(uint16_t pageIndex, bool force);
+uint8_t prefetchSlot(uint16_t pageIndex);
+void planPrefetch();
+void prefetchTask();
+uint8_t *configBlock(uint32_t block);
+void forgetConfigBlock();
+bool readConfig(uint32_t position, void *data, uint16_t len);
+uint32_t imageLocation(uint32_t imageNumber);
+bool pageLocations(uint16_t pageIndex, uint32_t *locations);
+void unpackImageData(uint8_t *out, uint16_t len);
+void drawBands(uint8_t display, uint8_t *data, uint8_t band, uint8_t count);
+void drawBandsEnd();
+void drawChunk(uint16_t displays, uint8_t *data, uint8_t band, uint8_t count);
+bool readSector(uint8_t *sector);
+bool displayImageBlocks(uint16_t displays, uint32_t location);
+uint32_t shownLocation(uint32_t location);
+void displayImage(uint8_t display, uint32_t imageNumber, bool force);
+void displayImages(uint16_t displays, uint32_t location, bool force);
+void displayImageChunks(uint16_t displays, uint32_t location, bool aligned);
+void load_images(uint16_t pageIndex, bool force, uint8_t pressed);
+void load_button(uint16_t pageIndex, uint8_t buttonIndex);
 void load_buttons(uint16_t pageIndex);
-uint8_t getCommand(uint8_t button, uint8_t secondary);
+void patchRow(uint16_t pageIndex, uint8_t buttonIndex, const uint8_t *row);
+bool patchImage(uint16_t pageIndex, uint8_t buttonIndex, uint8_t band, const uint8_t *data);
+uint32_t rowOffset(uint16_t pageIndex, uint8_t button, uint8_t secondary);
+void openPayload(uint8_t button, uint8_t secondary);
+uint8_t readPayload();
+void load_action(uint8_t buttonIndex, uint8_t secondary, const uint8_t *row);
 void onButtonPress(uint8_t buttonIndex, uint8_t secondary, bool leave);
 void onButtonRelease(uint8_t buttonIndex, uint8_t secondary, bool leave);
 void loadPage(uint16_t pageIndex, bool force);
-void checkButtonState(uint8_t buttonIndex);
+void scanButtons();
+void buttonTask();
 void initAllDisplays(uint8_t oled_delay, uint8_t pre_charge_period, uint8_t refresh_frequency);
+void bootDisplays();
+void profileName(uint8_t profile, char *name);
 void loadConfigFile();
+bool switchProfile(uint8_t profile);
 void initSdCard();
+void memoryReport(uint16_t *report);
 void postSetup();
 void sleepTask();
 void switchScreensOff();
@@ -8,6 +8,21 @@
 #include "../version.h"
 #include "./FreeDeck.h"
 #include "./OledTurboLight.h"
+#include "./Profiler.h"
+
+uint16_t frameRemaining = 0;  // payload bytes of the current frame not read yet
+uint16_t frameCrc;
+uint16_t replyCrc;
+// live display streaming statistics
+unsigned long streamSince = 0;
+uint32_t streamFrames[BD_COUNT] = {0};
+// block upload into TEMP_FILE, uploadSize is 0 while none is open
+File uploadFile;
+uint32_t uploadSize = 0;
+uint32_t uploadReceived = 0;
+uint32_t uploadFirstBlock;
+uint16_t uploadFileCrc;  // crc16 of the whole file, from the host
+uint16_t uploadCrc;      // crc16 of the bytes received
 
 void _dumpConfigFileOverSerial() {
   configFile.seekSet(0);
@@ -15,10 +30,9 @@ void _dumpConfigFileOverSerial() {
     Serial.println(configFile.fileSize());
     byte buff[SERIAL_TX_BUFFER_SIZE] = {0};
     int read;
-    do {
-      read = configFile.read(buff, SERIAL_TX_BUFFER_SIZE);
+    while ((read = configFile.read(buff, SERIAL_TX_BUFFER_SIZE)) > 0) {
       Serial.write(buff, read);
-    } while (read >= SERIAL_TX_BUFFER_SIZE);
+    }
   }
 }
 
@@ -30,6 +44,9 @@ void _renameTempFileToConfigFile(char const *path) {
 }
 
 void _openTempFile() {
+  // a block upload into it would be written to freed clusters
+  uploadFile.close();
+  uploadSize = 0;
   if (SD.exists(TEMP_FILE)) {
     SD.remove(TEMP_FILE);
   }
@@ -55,15 +72,16 @@ void _saveNewConfigFileFromSerial() {
     if (millis() - ellapsed > 1000) {
       break;
     }
-    byte input[SERIAL_RX_BUFFER_SIZE * 2];
-    chunkLength = Serial.readBytes(input, SERIAL_RX_BUFFER_SIZE * 2);
+    chunkLength = Serial.readBytes(imageCache, IMG_CACHE_SIZE);
     if (chunkLength)
       ellapsed = millis();
     receivedBytes += chunkLength;
-    configFile.write(input, chunkLength);
+    configFile.write(imageCache, chunkLength);
   } while (receivedBytes < fileSize);
   if (receivedBytes == fileSize) {
-    _renameTempFileToConfigFile(CONFIG_NAME);
+    char name[PROFILE_NAME_SIZE];
+    profileName(activeProfile, name);
+    _renameTempFileToConfigFile(name);
   }
   configFile.close();
 }
@@ -74,10 +92,8 @@ unsigned long int readSerialAscii() {
   if (len == 0)
     return ULONG_MAX;
   // remove any trailing extra stuff that atol does not like
-  char clean[len + 1];
-  memcpy(clean, &numberChars[0], len + 1 * sizeof(char));
-  clean[len] = '\0';
-  return atol(clean);
+  numberChars[len] = '\0';
+  return atol(numberChars);
 }
 
 unsigned long int readSerialBinary() {
@@ -97,28 +113,93 @@ unsigned long int readSerialBinary() {
 
 void oled_write_data() {
   last_data_received = millis();
-  uint8_t display = readSerialBinary();
-  setMuxAddress(display, DISPLAY);
+  unsigned long display = readSerialBinary();
+  // the image of an unknown display is read and dropped
+  bool valid = display < BD_COUNT;
+  if (valid) {
+    setMuxAddress(display, TYPE_DISPLAY);
+    invalidateDisplay(display);
+    oledDataBegin(0);
+  }
   uint16_t received = 0;
-  unsigned char buffer[1024];
   uint32_t ellapsed = millis();
+  while (received < 1024 && millis() - ellapsed < 1000) {
+    size_t len = Serial.readBytes(imageCache, min(IMG_CACHE_SIZE, 1024 - received));
+    if (len) {
+      ellapsed = millis();
+      if (valid)
+        oledDataPush(imageCache, len);
+      received += len;
+    }
+  }
+  if (valid)
+    oledDataEnd();
+}
 
-  do {
-    while (!Serial.available()) {
-      if (millis() - ellapsed > 1000) {
-        break;
-      }
-    };
-    ellapsed = millis();
-    uint8_t temp[IMG_CACHE_SIZE];
-    size_t len = Serial.readBytes(temp, IMG_CACHE_SIZE);
-    oledLoadBMPPart(temp, IMG_CACHE_SIZE, received);
-    received += len;
-  } while (received < 1024);
+void _benchmarkPageLoads() {
+  unsigned long stride = readSerialAscii();
+  if (stride == ULONG_MAX || stride == 0)
+    stride = 1;
+  uint16_t startPage = currentPage;
+  uint16_t pages = 0;
+  unsigned long total = 0;
+  unsigned long fastest = ULONG_MAX;
+  unsigned long slowest = 0;
+  for (unsigned long page = 0; page < pageCount; page += stride) {
+    unsigned long start = micros();
+    loadPage(page, true);
+    unsigned long took = micros() - start;
+    total += took;
+    fastest = min(fastest, took);
+    slowest = max(slowest, took);
+    pages++;
+    Serial.print(page);
+    Serial.print('\t');
+    Serial.println(took);
+  }
+  loadPage(startPage, true);
+  if (pages == 0) {
+    Serial.println(ERROR);
+    return;
+  }
+  // summary line in microseconds: average per page and per display, fastest
+  // and slowest page. with a flat seek the spread does not grow with the page
+  Serial.print(total / pages);
+  Serial.print('\t');
+  Serial.print(total / pages / BD_COUNT);
+  Serial.print('\t');
+  Serial.print(fastest);
+  Serial.print('\t');
+  Serial.println(slowest);
+}
+
+void _measureDisplayThroughput() {
+  setMuxAddress(0, TYPE_DISPLAY);
+  unsigned long speed = oledMeasureThroughput();
+  invalidateDisplay(0);
+  displayImage(0, (uint32_t)currentPage * BD_COUNT, true);
+  Serial.print(I2C_TRANSPORT);
+  Serial.print('\t');
+  Serial.println(speed);
+}
+
+// false if there is no such page
+bool _setPage(unsigned long targetPage) {
+  bool valid = targetPage < pageCount;
+  if (valid) {
+    release_keys();
+    Consumer.releaseAll();
+    loadPage(targetPage, false);
+  }
+#ifdef WAKE_ON_SET_PAGE_SERIAL
+  wake_display_if_needed();
+#endif
+  return valid;
 }
 
 void handleAPI() {
   unsigned long command = readSerialBinary();
+  forgetConfigBlock();  // a previous command may have used the sd cache
   if (command == 0x10) {  // get firmware version
     Serial.println(F(FW_VERSION));
   }
@@ -131,8 +212,6 @@ void handleAPI() {
   }
   if (command == 0x21) {  // write config
     _saveNewConfigFileFromSerial();
-    initAllDisplays(oled_delay, pre_charge_period, refresh_frequency);
-    delay(200);
     postSetup();
     delay(200);
   }
@@ -152,18 +231,26 @@ void handleAPI() {
     unsigned long targetPage = readSerialAscii();
     if (targetPage == ULONG_MAX)
       return;
-    if (targetPage <= pageCount) {
-      Keyboard.releaseAll();
-      Consumer.releaseAll();
-      loadPage(targetPage, false);
-    }
-#ifdef WAKE_ON_SET_PAGE_SERIAL
-    wake_display_if_needed();
-#endif
+    _setPage(targetPage);
   }
   if (command == 0x32) {  // get page count
     Serial.println(pageCount);
   }
+  if (command == 0x34) {  // button scan statistics
+    Serial.print(scanRate);
+    Serial.print('\t');
+    Serial.println(maxButtonLatency);
+    maxButtonLatency = 0;
+  }
+  if (command == 0x35) {  // held keys
+    for (uint16_t key = 1; key < 256; key++) {
+      if (key_is_pressed(key)) {
+        Serial.print(key);
+        Serial.print('\t');
+      }
+    }
+    Serial.println();
+  }
   if (command == 0x43) {
     oled_write_data();
   }
@@ -176,9 +263,402 @@ void handleAPI() {
     loadPage(currentPage, false);
     setGlobalContrast(contrast);
   }
+  if (command == 0x45) {  // benchmark page loads
+    _benchmarkPageLoads();
+  }
+  if (command == 0x46) {  // display transport speed
+    _measureDisplayThroughput();
+  }
+}
+
+//
+// Framed protocol: FRAME_MAGIC, opcode, length (2), payload, crc16 (2)
+// the crc covers opcode, length and payload. all numbers are little endian.
+// replies use the same framing, their payload starts with a FRAME_ status
+//
+
+// Read up to len bytes of the current frame's payload
+uint16_t readFrame(void *data, uint16_t len) {
+  len = Serial.readBytes((uint8_t *)data, min(len, frameRemaining));
+  frameCrc = crc16(frameCrc, (uint8_t *)data, len);
+  frameRemaining -= len;
+  return len;
+}
+
+// Skip the unread payload and check the crc of the current frame
+bool endFrame() {
+  uint8_t skip;
+  while (frameRemaining && readFrame(&skip, 1))
+    ;
+  uint16_t crc;
+  if (frameRemaining || Serial.readBytes((uint8_t *)&crc, 2) < 2)
+    return false;
+  return crc == frameCrc;
+}
+
+void beginReply(uint8_t opcode, uint8_t status, uint16_t len) {
+  uint8_t header[] = {FRAME_MAGIC, opcode, (uint8_t)(len + 1), (uint8_t)((len + 1) >> 8), status};
+  Serial.write(header, sizeof(header));
+  replyCrc = crc16(0xffff, &header[1], sizeof(header) - 1);
+}
+
+void writeReply(const void *data, uint16_t len) {
+  Serial.write((const uint8_t *)data, len);
+  replyCrc = crc16(replyCrc, (const uint8_t *)data, len);
+}
+
+void endReply() {
+  Serial.write((uint8_t *)&replyCrc, 2);
+}
+
+void reply(uint8_t opcode, uint8_t status, const void *data, uint16_t len) {
+  beginReply(opcode, status, len);
+  writeReply(data, len);
+  endReply();
+}
+
+// Draw the bands of one display sent in a stream frame:
+// display (1), band mask (1), 128 bytes for every band set in the mask
+void _handleStreamFrame(uint8_t opcode) {
+  uint8_t head[2] = {0};
+  readFrame(head, 2);
+  uint8_t display = head[0];
+  if (display >= BD_COUNT) {
+    endFrame();
+    reply(opcode, FRAME_ERROR, NULL, 0);
+    return;
+  }
+  last_data_received = millis();
+  setMuxAddress(display, TYPE_DISPLAY);
+  forgetImage(display);
+  for (uint8_t band = 0; band < 8; band++) {
+    if (!(head[1] & (1 << band)))
+      continue;
+    if (readFrame(imageCache, 128) < 128)
+      break;
+    drawBands(display, imageCache, band, 1);
+  }
+  drawBandsEnd();
+  if (!endFrame()) {
+    // the display shows broken data, the host has to send all bands again
+    invalidateDisplay(display);
+    reply(opcode, FRAME_BAD_CRC, NULL, 0);
+    return;
+  }
+  streamFrames[display]++;
+  uint8_t credits = 1;
+  reply(opcode, FRAME_OK, &credits, 1);
+}
+
+//
+// Block upload: TEMP_FILE is allocated contiguously with one extra block at
+// its end, the trailer, which holds the upload size and crc, the bytes
+// received and their crc.
+// blocks are written to the card directly, bypassing the fat cache.
+//
+
+uint32_t _uploadBlocks(uint32_t size) {
+  return (size + UPLOAD_BLOCK_SIZE - 1) / UPLOAD_BLOCK_SIZE;
+}
+
+void _writeUploadTrailer() {
+  uint8_t *buffer = SD.vol()->cacheClear()->data;
+  memset(buffer, 0, UPLOAD_BLOCK_SIZE);
+  memcpy(buffer, &uploadSize, 4);
+  memcpy(buffer + 4, &uploadReceived, 4);
+  memcpy(buffer + 8, &uploadFileCrc, 2);
+  memcpy(buffer + 10, &uploadCrc, 2);
+  SD.card()->writeBlock(uploadFirstBlock + _uploadBlocks(uploadSize), buffer);
+}
+
+// Open the upload of a file of size bytes and crc16 crc, resuming a previous
+// upload of the same file. uploadReceived is where the host has to continue
+bool _beginUpload(uint32_t size, uint16_t crc) {
+  uint32_t allocated = (_uploadBlocks(size) + 1) * UPLOAD_BLOCK_SIZE;
+  uint32_t lastBlock;
+  uploadFile.close();
+  uploadSize = 0;
+  uploadReceived = 0;
+  if (size == 0)
+    return false;
+  if (uploadFile.open(SD.vwd(), TEMP_FILE, O_RDWR) && uploadFile.fileSize() == allocated &&
+      uploadFile.contiguousRange(&uploadFirstBlock, &lastBlock)) {
+    uint32_t trailer[3];
+    uploadFile.seekSet(allocated - UPLOAD_BLOCK_SIZE);
+    // an upload of another file of the same size starts over
+    if (uploadFile.read(trailer, 12) == 12 && trailer[0] == size && trailer[1] <= size &&
+        (uint16_t)trailer[2] == crc) {
+      uploadSize = size;
+      uploadReceived = trailer[1];
+      uploadFileCrc = crc;
+      uploadCrc = trailer[2] >> 16;
+      return true;
+    }
+  }
+  uploadFile.close();
+  if (SD.exists(TEMP_FILE)) {
+    SD.remove(TEMP_FILE);
+  }
+  if (!uploadFile.createContiguous(SD.vwd(), TEMP_FILE, allocated) ||
+      !uploadFile.contiguousRange(&uploadFirstBlock, &lastBlock)) {
+    uploadFile.close();
+    return false;
+  }
+  uploadSize = size;
+  uploadFileCrc = crc;
+  uploadCrc = 0xffff;
+  _writeUploadTrailer();
+  return true;
+}
+
+// Write one block: offset (4), up to UPLOAD_BLOCK_SIZE bytes.
+// only the block at the received offset is taken, every reply carries it
+void _handleUploadBlock(uint8_t opcode) {
+  uint32_t offset = 0;
+  readFrame(&offset, 4);
+  uint16_t len = frameRemaining;
+  // a block is full up to the end of the upload, none is taken past it.
+  // a block past the end would be written over the trailer or other files
+  if (!uploadSize || uploadReceived == uploadSize || offset != uploadReceived ||
+      len != min((uint32_t)UPLOAD_BLOCK_SIZE, uploadSize - offset)) {
+    endFrame();
+    reply(opcode, FRAME_ERROR, &uploadReceived, 4);
+    return;
+  }
+  // the fat cache is the only buffer big enough for a whole block
+  uint8_t *buffer = SD.vol()->cacheClear()->data;
+  memset(buffer + len, 0, UPLOAD_BLOCK_SIZE - len);
+  readFrame(buffer, len);
+  if (!endFrame()) {
+    reply(opcode, FRAME_BAD_CRC, &uploadReceived, 4);
+    return;
+  }
+  if (!SD.card()->writeBlock(uploadFirstBlock + offset / UPLOAD_BLOCK_SIZE, buffer)) {
+    reply(opcode, FRAME_ERROR, &uploadReceived, 4);
+    return;
+  }
+  uploadReceived += len;
+  uploadCrc = crc16(uploadCrc, buffer, len);
+  if (uploadReceived == uploadSize || _uploadBlocks(uploadReceived) % UPLOAD_TRAILER_INTERVAL == 0)
+    _writeUploadTrailer();
+  reply(opcode, FRAME_OK, &uploadReceived, 4);
+}
+
+// Replace the config of a profile with the finished upload,
+// if its crc is the one the host announced
+bool _commitUpload(uint8_t profile) {
+  char name[PROFILE_NAME_SIZE];
+  if (!uploadSize || uploadReceived != uploadSize || uploadCrc != uploadFileCrc ||
+      profile >= PROFILE_COUNT)
+    return false;
+  profileName(profile, name);
+  uploadFile.truncate(uploadSize);
+  if (profile == activeProfile)
+    configFile.close();
+  if (SD.exists(name)) {
+    SD.remove(name);
+  }
+  bool renamed = uploadFile.rename(SD.vwd(), name);
+  uploadFile.close();
+  uploadSize = 0;
+  return renamed;
+}
+
+// Overwrite a part of the config in place once the crc matched:
+// 0x26 page (2), button (1), the 128 bytes of its row
+// 0x27 page (2), button (1), band (1), 128 bytes of its image
+void _handlePatchFrame(uint8_t opcode) {
+  uint8_t head[4] = {0};
+  readFrame(head, opcode == 0x26 ? 3 : 4);
+  bool complete = readFrame(imageCache, ROW_SIZE) == ROW_SIZE;
+  if (!endFrame()) {
+    reply(opcode, FRAME_BAD_CRC, NULL, 0);
+    return;
+  }
+  uint16_t page = head[0] | head[1] << 8;
+  bool patched = complete && page < pageCount && head[2] < BD_COUNT;
+  if (patched && opcode == 0x26)
+    patchRow(page, head[2], imageCache);
+  else if (patched)
+    patched = patchImage(page, head[2], head[3], imageCache);
+  reply(opcode, patched ? FRAME_OK : FRAME_ERROR, NULL, 0);
+}
+
+// Send a range of the config in reply frames split at sector boundaries:
+// offset (4), up to 512 bytes. a contiguous config is read with a multi block
+// read into the sd library's sector cache and sent from there without a copy.
+// a summary frame with opcode + 1 follows: bytes sent (4), microseconds (4)
+void _dumpConfigRange(uint8_t opcode, uint32_t offset, uint32_t length) {
+  unsigned long start = micros();
+  uint32_t size = configFile.fileSize();
+  offset = min(offset, size);
+  length = min(length, size - offset);
+  uint32_t end = offset + length;
+  uint8_t *sector = NULL;
+  if (configFirstBlock && length) {
+    sector = SD.vol()->cacheClear()->data;
+    if (!SD.card()->readStart(configFirstBlock + offset / 512))
+      sector = NULL;
+  }
+  if (!sector)
+    configFile.seekSet(offset);
+  while (offset < end) {
+    uint16_t skip = offset % 512;
+    uint16_t len = min(512 - skip, end - offset);
+    if (sector && !SD.card()->readData(sector))
+      break;
+    beginReply(opcode, FRAME_OK, 4 + len);
+    writeReply(&offset, 4);
+    uint16_t sent = 0;
+    if (sector) {
+      writeReply(sector + skip, len);
+      sent = len;
+    }
+    while (sent < len) {
+      int read = configFile.read(imageCache, min(IMG_CACHE_SIZE, len - sent));
+      if (read <= 0)
+        break;
+      writeReply(imageCache, read);
+      sent += read;
+    }
+    // a short frame fails its crc check on the host
+    endReply();
+    if (sent < len)
+      break;
+    offset += len;
+  }
+  if (sector)
+    SD.card()->readStop();
+  uint32_t summary[] = {length - (end - offset), (uint32_t)(micros() - start)};
+  reply(opcode + 1, offset == end ? FRAME_OK : FRAME_ERROR, summary, sizeof(summary));
+}
+
+void handleFrame() {
+  uint8_t header[4];
+  if (Serial.readBytes(header, 4) < 4)
+    return;
+  uint8_t opcode = header[1];
+  frameRemaining = header[2] | header[3] << 8;
+  frameCrc = crc16(0xffff, &header[1], 3);
+  // dumps, uploads and file lookups of a previous frame may have used the
+  // sd cache, the config block readConfig left there is gone
+  forgetConfigBlock();
+
+  if (opcode == 0x41) {
+    _handleStreamFrame(opcode);
+    return;
+  }
+  if (opcode == 0x24) {
+    _handleUploadBlock(opcode);
+    return;
+  }
+  if (opcode == 0x26 || opcode == 0x27) {
+    _handlePatchFrame(opcode);
+    return;
+  }
+  uint8_t args[FRAME_ARGS_SIZE] = {0};
+  uint8_t argsLength = readFrame(args, FRAME_ARGS_SIZE);
+  if (!endFrame()) {
+    reply(opcode, FRAME_BAD_CRC, NULL, 0);
+    return;
+  }
+  if (opcode == 0x10) {  // get firmware version
+    reply(opcode, FRAME_OK, FW_VERSION, sizeof(FW_VERSION) - 1);
+  } else if (opcode == 0x11) {  // boot phase timings
+    reply(opcode, FRAME_OK, bootTimes, BOOT_PHASES * sizeof(bootTimes[0]));
+  } else if (opcode == 0x13) {  // memory report
+    uint16_t report[MEMORY_REPORT_SIZE];
+    memoryReport(report);
+    reply(opcode, FRAME_OK, report, sizeof(report));
+#ifdef PROFILER
+  } else if (opcode == 0x12) {  // profiler histograms, reset after the dump if the argument is 1
+    uint8_t shape[] = {PROBE_COUNT, PROFILE_BUCKETS};
+    beginReply(opcode, FRAME_OK, sizeof(shape) + sizeof(profileCounts) + sizeof(profileMax));
+    writeReply(shape, sizeof(shape));
+    writeReply(profileCounts, sizeof(profileCounts));
+    writeReply(profileMax, sizeof(profileMax));
+    endReply();
+    if (argsLength && args[0] == 1)
+      profileReset();
+#endif
+  } else if (opcode == 0x22) {  // config has json
+    reply(opcode, FRAME_OK, &has_json, 1);
+  } else if (opcode == 0x23) {  // begin or resume an upload, reply with the bytes received
+    uint32_t size;
+    uint16_t crc;
+    memcpy(&size, args, 4);
+    memcpy(&crc, args + 4, 2);
+    bool open = argsLength >= 6 && _beginUpload(size, crc);
+    reply(opcode, open ? FRAME_OK : FRAME_ERROR, &uploadReceived, 4);
+  } else if (opcode == 0x25) {  // replace the config of a profile, the active one by default
+    uint8_t profile = argsLength ? args[0] : activeProfile;
+    if (!_commitUpload(profile)) {
+      reply(opcode, FRAME_ERROR, &uploadReceived, 4);
+      return;
+    }
+    reply(opcode, FRAME_OK, NULL, 0);
+    if (profile == activeProfile)
+      postSetup();
+  } else if (opcode == 0x28) {  // read a range of the config: offset (4), length (4)
+    uint32_t range[2];
+    memcpy(range, args, sizeof(range));
+    _dumpConfigRange(opcode, range[0], range[1]);
+  } else if (opcode == 0x50) {  // switch the active profile
+    reply(opcode, switchProfile(args[0]) ? FRAME_OK : FRAME_ERROR, NULL, 0);
+  } else if (opcode == 0x51) {  // active profile and a bit for every profile on the card
+    char name[PROFILE_NAME_SIZE];
+    uint16_t profiles = 0;
+    for (uint8_t profile = 0; profile < PROFILE_COUNT && profile < 16; profile++) {
+      profileName(profile, name);
+      if (SD.exists(name))
+        profiles |= 1 << profile;
+    }
+    beginReply(opcode, FRAME_OK, 3);
+    writeReply(&activeProfile, 1);
+    writeReply(&profiles, 2);
+    endReply();
+  } else if (opcode == 0x30) {  // get current page and if it was changed by hand
+    uint8_t page[] = {(uint8_t)currentPage, (uint8_t)(currentPage >> 8), last_human_action + PAGE_CHANGE_SERIAL_TIMEOUT >= millis()};
+    reply(opcode, FRAME_OK, page, sizeof(page));
+#ifdef WAKE_ON_GET_PAGE_SERIAL
+    wake_display_if_needed();
+#endif
+  } else if (opcode == 0x31) {  // set current page
+    bool loaded = _setPage(args[0] | args[1] << 8);
+    reply(opcode, loaded ? FRAME_OK : FRAME_ERROR, NULL, 0);
+  } else if (opcode == 0x32) {  // get page count
+    reply(opcode, FRAME_OK, &pageCount, 2);
+  } else if (opcode == 0x33) {  // timing of the last page redraw
+    beginReply(opcode, FRAME_OK, 9);
+    writeReply(&redrawFirst, 4);
+    writeReply(&redrawTotal, 4);
+    writeReply(&redrawCount, 1);
+    endReply();
+  } else if (opcode == 0x40) {  // open a display stream, reply with the credits
+    streamSince = millis();
+    memset(streamFrames, 0, sizeof(streamFrames));
+    uint8_t credits = STREAM_CREDITS;
+    reply(opcode, FRAME_OK, &credits, 1);
+  } else if (opcode == 0x42) {  // stream frames per second * 100 for every display
+    unsigned long ellapsed = max(millis() - streamSince, 1UL);
+    beginReply(opcode, FRAME_OK, BD_COUNT * 2);
+    for (uint8_t display = 0; display < BD_COUNT; display++) {
+      // in 64 bit, frames * 100000 passes 32 bit after 42949 frames
+      uint16_t fps = (uint64_t)streamFrames[display] * 100000 / ellapsed;
+      writeReply(&fps, 2);
+    }
+    endReply();
+  } else {
+    reply(opcode, FRAME_UNKNOWN, NULL, 0);
+  }
 }
 
 void handleSerial() {
+  PROFILE(PROBE_SERIAL);
+  // any number of frames can be sent back to back
+  while (Serial.available() > 0 && Serial.peek() == FRAME_MAGIC) {
+    handleFrame();
+  }
   if (Serial.available() > 0) {
     unsigned long read = readSerialBinary();
     if (read == 0x3) {
@@ -1,12 +1,46 @@
+#include <Arduino.h>
+
 #define OK F("ok")
 #define ERROR F("err")
 
+#define FRAME_MAGIC 0xfd
+// bytes of a frame's payload kept for its handler
+#define FRAME_ARGS_SIZE 8
+// status byte at the start of every reply
+#define FRAME_OK 0
+#define FRAME_BAD_CRC 1
+#define FRAME_UNKNOWN 2
+#define FRAME_ERROR 3
+// stream frames the host may send before waiting for a reply
+#define STREAM_CREDITS 2
+// uploads are written in sd card blocks, the host sends one per frame
+#define UPLOAD_BLOCK_SIZE 512
+// blocks written between two updates of the resume trailer
+#define UPLOAD_TRAILER_INTERVAL 8
+
 void _dumpConfigFileOverSerial();
+void _dumpConfigRange(uint8_t opcode, uint32_t offset, uint32_t length);
 void _renameTempFileToConfigFile(char const *path);
 void _openTempFile();
 long _getSerialFileSize();
 void _saveNewConfigFileFromSerial();
+void _benchmarkPageLoads();
+void _measureDisplayThroughput();
+bool _setPage(unsigned long targetPage);
 void handleAPI();
+uint16_t readFrame(void *data, uint16_t len);
+bool endFrame();
+void beginReply(uint8_t opcode, uint8_t status, uint16_t len);
+void writeReply(const void *data, uint16_t len);
+void endReply();
+void reply(uint8_t opcode, uint8_t status, const void *data, uint16_t len);
+void _handleStreamFrame(uint8_t opcode);
+void _writeUploadTrailer();
+bool _beginUpload(uint32_t size, uint16_t crc);
+void _handleUploadBlock(uint8_t opcode);
+bool _commitUpload(uint8_t profile);
+void _handlePatchFrame(uint8_t opcode);
+void handleFrame();
 void handleSerial();
 unsigned long int readSerialAscii();
 unsigned long int readSerialBinary();
\ No newline at end of file
@@ -41,4 +41,33 @@ int freeMemory() {
     free_memory += freeListSize();
   }
   return free_memory;
+}
+
+/* Pattern the unused ram between the heap and the stack is filled with */
+#define STACK_PAINT 0xc5
+
+static uint8_t *heapEnd() {
+  return (int)__brkval == 0 ? (uint8_t *)&__heap_start : (uint8_t *)__brkval;
+}
+
+/* Fills the free ram below the current stack frame with STACK_PAINT */
+void paintStack() {
+  uint8_t *p = heapEnd();
+  uint8_t *sp = (uint8_t *)&p - 16;
+  while (p < sp)
+    *p++ = STACK_PAINT;
+}
+
+/*
+ * Counts the painted bytes above the heap, the free ram left when the
+ * stack was deepest since paintStack
+ */
+int minFreeStack() {
+  uint8_t *p = heapEnd();
+  int free_stack = 0;
+  while (*p == STACK_PAINT && p < (uint8_t *)&free_stack) {
+    p++;
+    free_stack++;
+  }
+  return free_stack;
 }
\ No newline at end of file
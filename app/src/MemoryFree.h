@@ -10,6 +10,8 @@ extern "C" {
 #endif
 
 int freeMemory();
+void paintStack();
+int minFreeStack();
 
 #ifdef __cplusplus
 }
@@ -4,14 +4,76 @@
 
 #include "../settings.h"
 #include "./FreeDeck.h"
+#include "./Profiler.h"
 
 // some globals
-static int iScreenOffset;  // current write offset of screen data
+#define CURSOR_UNKNOWN -1
+static int iScreenOffset[BD_COUNT];  // current write offset of screen data per display
+static uint8_t oled_display;         // the display the multiplexer points to
 static uint8_t oled_addr;
 static uint8_t bCache[MAX_CACHE] = {0x40};  // for faster character drawing
 static uint8_t bEnd = 1;
+static uint8_t data_introducer = 0x40;  // data command
 static void oledWriteCommand(unsigned char c);
 
+#if I2C_TRANSPORT == I2C_HARDWARE
+//
+// ATmega32u4 TWI peripheral on PD1 (SDA) and PD0 (SCL)
+//
+static inline void twiWait() {
+  while (!(TWCR & _BV(TWINT)))
+    ;
+}
+
+static inline void twiInit() {
+  TWSR = 0;  // prescaler 1
+  TWBR = ((F_CPU / I2C_HARDWARE_HZ) - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+// every write waits for the byte before it, so the last byte of a chunk is
+// shifted out while the next chunk is read from the sd card
+void i2cBegin(uint8_t addr) {
+  TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);  // START
+  twiWait();
+  TWDR = addr << 1;
+  TWCR = _BV(TWINT) | _BV(TWEN);
+} /* i2cBegin() */
+
+void i2cWrite(uint8_t *pData, uint8_t bLen) {
+  while (bLen--) {
+    twiWait();
+    TWDR = *pData++;
+    TWCR = _BV(TWINT) | _BV(TWEN);
+  }
+} /* i2cWrite() */
+
+void i2cEnd() {
+  twiWait();
+  TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+  while (TWCR & _BV(TWSTO))
+    ;
+} /* i2cEnd() */
+
+#else
+#if I2C_TRANSPORT == I2C_BITBANG_FAST
+// half of a clock period in cpu cycles, no delay loop calls
+#define I2C_WAIT() __builtin_avr_delay_cycles(F_CPU / 2 / I2C_FAST_HZ)
+#else
+#define I2C_WAIT() delayMicroseconds(oled_delay)
+#endif
+
+// clock out the bit of b selected by mask
+#define I2C_BIT_OUT(b, mask)   \
+  bOld &= ~(1 << BB_SDA);      \
+  if (b & (mask))              \
+    bOld |= (1 << BB_SDA);     \
+  I2CPORT = bOld;              \
+  I2C_WAIT();                  \
+  I2CPORT |= (1 << BB_SCL);    \
+  I2C_WAIT();                  \
+  I2C_CLK_LOW();
+
 //
 // Transmit a uint8_t and ack bit
 //
@@ -19,21 +81,14 @@ static inline void i2cByteOut(uint8_t b) {
   uint8_t i;
   uint8_t bOld = I2CPORT & ~((1 << BB_SDA) | (1 << BB_SCL));
   for (i = 0; i < 8; i++) {
-    bOld &= ~(1 << BB_SDA);
-    if (b & 0x80)
-      bOld |= (1 << BB_SDA);
-    I2CPORT = bOld;
-    delayMicroseconds(oled_delay);
-    I2CPORT |= (1 << BB_SCL);
-    delayMicroseconds(oled_delay);
-    I2C_CLK_LOW();
+    I2C_BIT_OUT(b, 0x80);
     b <<= 1;
   }                                 // for i
                                     // ack bit
   I2CPORT = bOld & ~(1 << BB_SDA);  // set data low
-  delayMicroseconds(oled_delay);
+  I2C_WAIT();
   I2CPORT |= (1 << BB_SCL);  // toggle clock
-  delayMicroseconds(oled_delay);
+  I2C_WAIT();
   I2C_CLK_LOW();
 } /* i2cByteOut() */
 
@@ -57,26 +112,30 @@ void i2cWrite(uint8_t *pData, uint8_t bLen) {
       if (b & 0x80)
         bOld |= (1 << BB_SDA);
       I2CPORT = bOld;
-      delayMicroseconds(oled_delay);
+      I2C_WAIT();
       for (i = 0; i < 8; i++) {
         I2CPORT |=
             (1 << BB_SCL);  // just toggle SCL, SDA stays the same
-        delayMicroseconds(oled_delay);
+        I2C_WAIT();
         I2C_CLK_LOW();
       }       // for i
     } else {  // normal uint8_t needs every bit tested
+#if I2C_TRANSPORT == I2C_BITBANG_FAST
+      // unrolled, the loop overhead is bigger than the clock delay
+      I2C_BIT_OUT(b, 0x80);
+      I2C_BIT_OUT(b, 0x40);
+      I2C_BIT_OUT(b, 0x20);
+      I2C_BIT_OUT(b, 0x10);
+      I2C_BIT_OUT(b, 0x08);
+      I2C_BIT_OUT(b, 0x04);
+      I2C_BIT_OUT(b, 0x02);
+      I2C_BIT_OUT(b, 0x01);
+#else
       for (i = 0; i < 8; i++) {
-        bOld &= ~(1 << BB_SDA);
-        if (b & 0x80)
-          bOld |= (1 << BB_SDA);
-
-        I2CPORT = bOld;
-        delayMicroseconds(oled_delay);
-        I2CPORT |= (1 << BB_SCL);
-        delayMicroseconds(oled_delay);
-        I2C_CLK_LOW();
+        I2C_BIT_OUT(b, 0x80);
         b <<= 1;
       }  // for i
+#endif
     }
     // ACK bit seems to need to be set to 0, but SDA
     // line doesn't need to be tri-state
@@ -96,6 +155,7 @@ void i2cEnd() {
   // let the lines float (tri-state)
   I2CDDR &= ~((1 << BB_SDA) | (1 << BB_SCL));
 } /* i2cEnd() */
+#endif
 
 // Wrapper function to write I2C data on Arduino
 static void I2CWrite(int iAddr, unsigned char *pData, int iLen) {
@@ -105,21 +165,30 @@ static void I2CWrite(int iAddr, unsigned char *pData, int iLen) {
 } /* I2CWrite() */
 
 //
-// Initializes the OLED controller into "page mode"
+// Initializes the OLED controller into horizontal addressing mode,
+// the display stays off until oledTurnOn
 //
 void oledInit(uint8_t bAddr, uint8_t pre_charge_period, uint8_t refresh_frequency) {
   unsigned char uc[4];
   unsigned char oled_initbuf[] = {
       0x00, 0xae, 0xa8, 0x3f, 0xd3, 0x00, 0x40, 0xa1, 0xc8, 0xda, 0x12,
-      0x81, 0xff, 0xa4, 0xa6, 0xd5, refresh_frequency, 0x8d, 0x14, 0xaf, 0x20, 0x00, 0xd9, pre_charge_period, 0xdb, MINIMUM_BRIGHTNESS};
+      0x81, 0xff, 0xa4, 0xa6, 0xd5, refresh_frequency, 0x8d, 0x14, 0x20, 0x00, 0xd9, pre_charge_period, 0xdb, MINIMUM_BRIGHTNESS};
 
   oled_addr = bAddr;
+#if I2C_TRANSPORT == I2C_HARDWARE
+  twiInit();
+#else
   I2CDDR &= ~(1 << BB_SDA);
   I2CDDR &= ~(1 << BB_SCL);  // let them float high
   I2CPORT |= (1 << BB_SDA);  // set both lines to get pulled up
   I2CPORT |= (1 << BB_SCL);
+#endif
 
   I2CWrite(oled_addr, oled_initbuf, sizeof(oled_initbuf));
+  // the init sequence selects horizontal addressing, set the full
+  // column and page range once so whole frames can be written in one go
+  iScreenOffset[oled_display] = CURSOR_UNKNOWN;
+  oledSetPosition(0, 0);
   // if (bInvert) {
   //   uc[0] = 0;    // command
   //   uc[1] = 0xa7; // invert command
@@ -141,7 +210,7 @@ void oledShutdown() {
 }
 
 void oledTurnOn() {
-  oledWriteCommand(0xaf);  // turn off OLED
+  oledWriteCommand(0xaf);  // turn on OLED
 }
 
 // Send a single uint8_t command to the OLED controller
@@ -169,15 +238,26 @@ void oledSetContrast(unsigned char ucContrast) {
   oledWriteCommand2(0x81, ucContrast);
 } /* oledSetContrast() */
 
+//
+// Select which display's cursor is tracked, call after switching the multiplexer
+//
+void oledSelect(uint8_t display) {
+  oled_display = display;
+}
+
 //
 // Send commands to position the "cursor" (aka memory write address)
-// to the given row and column
+// to the given row and column. In horizontal addressing mode the cursor
+// advances and wraps by itself, so this is skipped if it is already there
 //
 static void oledSetPosition(int x, int y) {
-  oledWriteCommand(0xb0 | y);                 // go to page Y
-  oledWriteCommand(0x00 | (x & 0xf));         // // lower col addr
-  oledWriteCommand(0x10 | ((x >> 4) & 0xf));  // upper col addr
-  iScreenOffset = (y * 128) + x;
+  int offset = (y * 128) + x;
+  if (iScreenOffset[oled_display] == offset)
+    return;
+  unsigned char buf[] = {0x00, 0x21, (unsigned char)x, 0x7f, 0x22, (unsigned char)y, 0x07};
+  I2CWrite(oled_addr, buf, sizeof(buf));
+  // with a column range not starting at 0 the wrap around is not tracked
+  iScreenOffset[oled_display] = x == 0 ? offset : CURSOR_UNKNOWN;
 }
 
 //
@@ -185,11 +265,41 @@ static void oledSetPosition(int x, int y) {
 // Length can be anything from 1 to 1024 (whole display)
 //
 static void oledWriteDataBlock(unsigned char *ucBuf, int iLen) {
-  unsigned char ucTemp[iLen + 1];
-  ucTemp[0] = 0x40;  // data command
-  memcpy(&ucTemp[1], ucBuf, iLen);
-  I2CWrite(oled_addr, ucTemp, iLen + 1);
-  // Keep a copy in local buffer
+  i2cBegin(oled_addr);
+  i2cWrite(&data_introducer, 1);
+  oledDataPush(ucBuf, iLen);
+  i2cEnd();
+}
+
+//
+// Position the cursor at offset and open a data transaction, which stays
+// open for any number of oledDataPush calls until oledDataEnd
+//
+void oledDataBegin(int offset) {
+  oledSetPosition(offset % 128, offset / 128);
+  i2cBegin(oled_addr);
+  i2cWrite(&data_introducer, 1);
+}
+
+void oledDataPush(uint8_t *pData, int iLen) {
+  PROFILE(PROBE_I2C);
+  // at the end of the display the cursor wraps to the first page of the range
+  // set by oledSetPosition, which is not necessarily page 0
+  if (iScreenOffset[oled_display] != CURSOR_UNKNOWN) {
+    iScreenOffset[oled_display] += iLen;
+    if (iScreenOffset[oled_display] >= 1024)
+      iScreenOffset[oled_display] = CURSOR_UNKNOWN;
+  }
+  while (iLen > 0) {
+    uint8_t bLen = min(iLen, 255);
+    i2cWrite(pData, bLen);
+    pData += bLen;
+    iLen -= bLen;
+  }
+}
+
+void oledDataEnd() {
+  i2cEnd();
 }
 
 // Set (or clear) an individual pixel
@@ -222,28 +332,41 @@ int oledSetPixel(int x, int y, unsigned char ucColor) {
 // First pass version assumes a full screen bitmap
 //
 void oledLoadBMPPart(uint8_t *pBMP, int bytes = 1024, int offset = 0) {
-  int y;  // offset to bitmap data
-  int iPitch = 128;
-  uint8_t factor = bytes / iPitch;  // 512/128 = 4
-  oledSetPosition(0, offset / 16 / 8);
-  for (y = 0; y < factor; y++) {  // 8 lines of 8 pixels
-    oledWriteDataBlock(&pBMP[y * iPitch], iPitch);
-  }  // for y
-  // oledCachedFlush();
+  oledDataBegin(offset);
+  oledDataPush(pBMP, bytes);
+  oledDataEnd();
 } /* oledLoadBMP() */
 //
 // Fill the frame buffer with a uint8_t pattern
 // e.g. all off (0x00) or all on (0xff)
 //
 void oledFill(unsigned char ucData) {
-  int x, y;
+  int x;
   unsigned char temp[16];
 
   memset(temp, ucData, 16);
-  for (y = 0; y < 8; y++) {
-    oledSetPosition(0, y);  // set to (0,Y)
-    for (x = 0; x < 8; x++) {
-      oledWriteDataBlock(temp, 16);
-    }  // for x
-  }    // for y
+  oledDataBegin(0);
+  for (x = 0; x < 1024 / 16; x++) {
+    oledDataPush(temp, 16);
+  }
+  oledDataEnd();
 }
+
+//
+// Send 4 frames of test data to the selected display
+// and return the achieved transport speed in bytes per second
+//
+unsigned long oledMeasureThroughput() {
+  unsigned char temp[16];
+  for (uint8_t i = 0; i < 16; i++) {
+    temp[i] = i & 1 ? 0x55 : 0xa5;  // avoid the 0x00/0xff shortcut
+  }
+  unsigned long start = micros();
+  oledDataBegin(0);
+  for (int block = 0; block < 4 * 1024 / 16; block++) {
+    oledDataPush(temp, 16);
+  }
+  oledDataEnd();
+  unsigned long took = micros() - start;
+  return 4 * 1024 * 1000000UL / took;
+}
\ No newline at end of file
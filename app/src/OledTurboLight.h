@@ -15,8 +15,13 @@ void oledShutdown();
 void oledTurnOn();
 static void oledWriteCommand(unsigned char c);
 void oledSetContrast(unsigned char ucContrast);
+void oledSelect(uint8_t display);
 static void oledSetPosition(int x, int y);
 static void oledWriteDataBlock(unsigned char *ucBuf, int iLen);
 int oledSetPixel(int x, int y, unsigned char ucColor);
+void oledDataBegin(int offset);
+void oledDataPush(uint8_t *pData, int iLen);
+void oledDataEnd();
 void oledLoadBMPPart(uint8_t *pBMP, int bytes, int offset);
-void oledFill(unsigned char ucData);
\ No newline at end of file
+void oledFill(unsigned char ucData);
+unsigned long oledMeasureThroughput();
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "./Profiler.h"
+
+#ifdef PROFILER
+uint16_t profileCounts[PROBE_COUNT][PROFILE_BUCKETS];
+unsigned long profileMax[PROBE_COUNT];
+
+void profileRecord(uint8_t probe, unsigned long us) {
+  uint8_t bucket = 0;
+  for (unsigned long rest = us; rest > 1 && bucket < PROFILE_BUCKETS - 1; rest >>= 1) {
+    bucket++;
+  }
+  if (profileCounts[probe][bucket] != 0xffff)
+    profileCounts[probe][bucket]++;
+  if (us > profileMax[probe])
+    profileMax[probe] = us;
+}
+
+void profileReset() {
+  memset(profileCounts, 0, sizeof(profileCounts));
+  memset(profileMax, 0, sizeof(profileMax));
+}
+#endif
@@ -0,0 +1,43 @@
+#include <Arduino.h>
+
+#include "../settings.h"
+
+// what the profiler measures, one histogram each
+#define PROBE_LOOP 0
+#define PROBE_SERIAL 1
+#define PROBE_SLEEP 2
+#define PROBE_SCAN 3
+#define PROBE_BUTTONS 4
+#define PROBE_MACROS 5
+#define PROBE_PREFETCH 6
+#define PROBE_DISPLAY 7
+#define PROBE_SD 8
+#define PROBE_I2C 9
+#define PROBE_COUNT 10
+// bucket n counts durations of 2^n to 2^(n+1) - 1 microseconds,
+// the last one everything longer
+#define PROFILE_BUCKETS 16
+
+#ifdef PROFILER
+extern uint16_t profileCounts[PROBE_COUNT][PROFILE_BUCKETS];
+extern unsigned long profileMax[PROBE_COUNT];
+void profileRecord(uint8_t probe, unsigned long us);
+void profileReset();
+
+// measures the time until it goes out of scope
+class ProfileScope {
+ public:
+  ProfileScope(uint8_t probe) : probe(probe), start(micros()) {}
+  ~ProfileScope() { profileRecord(probe, micros() - start); }
+
+ private:
+  uint8_t probe;
+  unsigned long start;
+};
+
+#define PROFILE(probe) ProfileScope _profileScope(probe)
+#define PROFILER_RAM (PROBE_COUNT * PROFILE_BUCKETS * 2 + PROBE_COUNT * 4)
+#else
+#define PROFILE(probe)
+#define PROFILER_RAM 0
+#endif
@@ -0,0 +1,147 @@
+// page switch benchmark on the simulated hardware. it boots a small config,
+// uploads a synthetic one with the framed and the legacy upload, loads every
+// page and writes every display with legacy command 0x43, and reports the
+// simulated microseconds of each step. exits with 1 if a display does not
+// show what it should, so it can run in CI
+//
+// usage: bench [-p pages] [-t] [-c]
+//   -p  pages of the synthetic config, 8 by default
+//   -t  use an image table, every fourth button shares an image
+//   -c  report the config as contiguous, so it is read with raw block reads
+#include <unistd.h>
+
+#include "../app/settings.h"
+#include "../app/src/FreeDeck.h"
+#include "./sim.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, int index) {
+  if (ok)
+    return;
+  printf("FAIL %s %d\n", what, index);
+  failures++;
+}
+
+static bool showsPage(const std::vector<uint8_t> &config, uint16_t page) {
+  bool ok = true;
+  for (uint8_t display = 0; display < BD_COUNT; display++) {
+    std::vector<uint8_t> image = simImage(config, page, display);
+    ok &= memcmp(simDisplays[display].ram, image.data(), 1024) == 0;
+  }
+  return ok;
+}
+
+// run the main loop until the sketch answered a frame
+static SimReply awaitReply() {
+  for (int i = 0; i < 1000; i++) {
+    loop();
+    std::vector<SimReply> replies = simTakeReplies();
+    if (!replies.empty())
+      return replies.back();
+  }
+  return SimReply{0, 0xff, {}, false};
+}
+
+static unsigned long framedUpload(const std::vector<uint8_t> &config) {
+  unsigned long start = simMicros();
+  std::vector<uint8_t> begin = simU32(config.size());
+  uint16_t crc = simCrc(config.data(), config.size());
+  begin.push_back(crc & 0xff);
+  begin.push_back(crc >> 8);
+  simSendFrame(0x23, begin);
+  check(awaitReply().status == 0, "upload begin", 0);
+  for (uint32_t offset = 0; offset < config.size(); offset += 512) {
+    std::vector<uint8_t> payload = simU32(offset);
+    uint32_t end = min(offset + 512, (uint32_t)config.size());
+    payload.insert(payload.end(), config.begin() + offset, config.begin() + end);
+    simSendFrame(0x24, payload);
+    check(awaitReply().status == 0, "upload block", offset / 512);
+  }
+  simSendFrame(0x25, {});
+  check(awaitReply().status == 0, "upload commit", 0);
+  return simMicros() - start;
+}
+
+static unsigned long legacyUpload(const std::vector<uint8_t> &config) {
+  unsigned long start = simMicros();
+  simSend("\x03\n\x21\n" + std::to_string(config.size()) + "\n");
+  simSend(config.data(), config.size());
+  loop();
+  return simMicros() - start;
+}
+
+int main(int argc, char **argv) {
+  uint16_t pages = 8;
+  bool table = false;
+  int option;
+  while ((option = getopt(argc, argv, "p:tc")) != -1) {
+    if (option == 'p')
+      pages = atoi(optarg);
+    else if (option == 't')
+      table = true;
+    else if (option == 'c')
+      simContiguous = true;
+    else
+      return 2;
+  }
+  if (pages < 2) {
+    printf("at least 2 pages\n");
+    return 2;
+  }
+
+  std::vector<uint8_t> first = simConfig(1);
+  simFiles[CONFIG_NAME] = first;
+  setup();
+  printf("boot_us %lu\n", simMicros());
+  check(showsPage(first, 0), "boot page", 0);
+
+  std::vector<uint8_t> config = simConfig(pages, table);
+  printf("config_bytes %zu\n", config.size());
+  printf("upload_framed_us %lu\n", framedUpload(config));
+  check(simFiles[CONFIG_NAME] == config, "framed upload", 0);
+  simFiles[CONFIG_NAME] = first;
+  printf("upload_legacy_us %lu\n", legacyUpload(config));
+  check(simFiles[CONFIG_NAME] == config, "legacy upload", 0);
+  check(showsPage(config, 0), "page after upload", 0);
+  simSerialOut.clear();
+
+  // every page once, ending on page 0 again
+  unsigned long total = 0, slowest = 0, displays = 0;
+  unsigned long reads = simBlockReads, i2c = simI2cBytes;
+  for (uint16_t i = 1; i <= pages; i++) {
+    uint16_t page = i % pages;
+    unsigned long start = simMicros();
+    loadPage(page, false);
+    unsigned long elapsed = simMicros() - start;
+    printf("page %u us %lu displays %u per_display_us %lu\n", page, elapsed, redrawCount,
+           redrawCount ? elapsed / redrawCount : 0);
+    check(showsPage(config, page), "page", page);
+    total += elapsed;
+    slowest = max(slowest, elapsed);
+    displays += redrawCount;
+  }
+  printf("page_avg_us %lu\n", total / pages);
+  printf("page_max_us %lu\n", slowest);
+  printf("per_display_avg_us %lu\n", displays ? total / displays : 0);
+  printf("page_block_reads %lu\n", (simBlockReads - reads) / pages);
+  printf("page_i2c_bytes %lu\n", (simI2cBytes - i2c) / pages);
+
+  // legacy display writes, each display gets the image of the next one
+  total = 0;
+  for (uint8_t display = 0; display < BD_COUNT; display++) {
+    std::vector<uint8_t> image = simImage(config, 1, (display + 1) % BD_COUNT);
+    std::string command = "\x03\n\x43\n";
+    command += (char)display;
+    command += '\n';
+    simSend(command);
+    simSend(image.data(), image.size());
+    unsigned long start = simMicros();
+    loop();
+    total += simMicros() - start;
+    check(memcmp(simDisplays[display].ram, image.data(), 1024) == 0, "display write", display);
+  }
+  printf("display_write_avg_us %lu\n", total / BD_COUNT);
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,822 @@
+// simulated freedeck hardware, see sim.h
+#include "./sim.h"
+
+#include <EEPROM.h>
+#include <HID-Project.h>
+#include <SdFat.h>
+#include <util/crc16.h>
+
+#include "../app/settings.h"
+#include "../app/src/FreeDeckSerialAPI.h"
+
+#if I2C_TRANSPORT == I2C_HARDWARE
+#error "the host build simulates the bit banged i2c transports only"
+#endif
+
+#define CYCLES_PER_US (F_CPU / 1000000L)
+
+uint64_t simCycles = 0;
+
+void simCharge(uint64_t cycles) {
+  simCycles += cycles;
+}
+
+unsigned long simMicros() {
+  return simCycles / CYCLES_PER_US;
+}
+
+void simRun(unsigned long us) {
+  uint64_t end = simCycles + (uint64_t)us * CYCLES_PER_US;
+  while (simCycles < end)
+    loop();
+}
+
+//
+// clock and pins
+//
+unsigned long micros() {
+  simCharge(SIM_CLOCK_READ_CYCLES);
+  return simMicros();
+}
+
+unsigned long millis() {
+  simCharge(SIM_CLOCK_READ_CYCLES);
+  return simMicros() / 1000;
+}
+
+void delay(unsigned long ms) {
+  simCharge((uint64_t)ms * 1000 * CYCLES_PER_US);
+}
+
+void delayMicroseconds(unsigned int us) {
+  simCharge((uint64_t)us * CYCLES_PER_US);
+}
+
+void simDelayCycles(unsigned long cycles) {
+  simCharge(cycles);
+}
+
+static uint8_t muxAddress = 0;
+uint16_t simButtonsDown = 0;
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  static const uint8_t muxPins[] = {S0_PIN, S1_PIN, S2_PIN, S3_PIN};
+  simCharge(SIM_PIN_CYCLES);
+  for (uint8_t bit = 0; bit < 4; bit++) {
+    if (muxPins[bit] != pin)
+      continue;
+    if (value)
+      muxAddress |= 1 << bit;
+    else
+      muxAddress &= ~(1 << bit);
+    return;  // SD_CS_PIN may share S3_PIN with up to 8 buttons
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  simCharge(SIM_PIN_CYCLES);
+  if (pin != BUTTON_PIN)
+    return HIGH;
+  return simButtonsDown & (1 << muxAddress) ? LOW : HIGH;  // pulled up
+}
+
+//
+// i2c bus and the SSD1306 displays on it
+//
+SimDisplay simDisplays[SIM_DISPLAYS];
+unsigned long simI2cBytes = 0;
+SimPort PORTD, DDRD;
+volatile uint8_t TWCR = _BV(TWINT), TWDR, TWBR, TWSR;
+
+static bool sda = true, scl = true;
+static bool transfer = false;
+static uint8_t bitCount, shifted;
+static uint16_t byteIndex;
+static bool commandStream;
+static SimDisplay *target;
+static uint8_t command[8];  // a command and its parameters
+static uint8_t commandLength = 0;
+
+static void resetDisplay(SimDisplay *display) {
+  memset(display, 0, sizeof(*display));
+  display->columnEnd = 127;
+  display->pageEnd = 7;
+}
+
+static uint8_t commandSize(uint8_t c) {
+  switch (c) {
+    case 0x21:
+    case 0x22:
+    case 0xa3:
+      return 3;
+    case 0x20:
+    case 0x81:
+    case 0x8d:
+    case 0xa8:
+    case 0xd3:
+    case 0xd5:
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+      return 2;
+    case 0x26:
+    case 0x27:
+      return 7;
+    case 0x29:
+    case 0x2a:
+      return 6;
+  }
+  return 1;
+}
+
+static void displayCommand(SimDisplay *display, uint8_t c) {
+  command[commandLength++] = c;
+  if (commandLength < commandSize(command[0]))
+    return;
+  commandLength = 0;
+  if (command[0] == 0xae || command[0] == 0xaf) {
+    display->on = command[0] == 0xaf;
+  } else if (command[0] == 0x81) {
+    display->contrast = command[1];
+  } else if (command[0] == 0x21) {
+    display->columnStart = display->column = command[1] & 0x7f;
+    display->columnEnd = command[2] & 0x7f;
+  } else if (command[0] == 0x22) {
+    display->pageStart = display->page = command[1] & 7;
+    display->pageEnd = command[2] & 7;
+  }
+}
+
+static void displayData(SimDisplay *display, uint8_t b) {
+  display->ram[display->page * 128 + display->column] = b;
+  display->dataBytes++;
+  if (display->column++ < display->columnEnd)
+    return;
+  display->column = display->columnStart;
+  if (display->page++ == display->pageEnd)
+    display->page = display->pageStart;
+}
+
+static void i2cByte(uint8_t b) {
+  simI2cBytes++;
+  uint16_t index = byteIndex++;
+  if (index == 0) {  // the slave address
+    target = (b >> 1) == 0x3c ? &simDisplays[muxAddress % SIM_DISPLAYS] : NULL;
+  } else if (index == 1) {
+    commandStream = !(b & 0x40);
+    commandLength = 0;
+  } else if (target && commandStream) {
+    displayCommand(target, b);
+  } else if (target) {
+    displayData(target, b);
+  }
+}
+
+// the lines are pulled up unless they are outputs driven low
+static void busChanged() {
+  bool newSda = !(DDRD & _BV(BB_SDA)) || (PORTD & _BV(BB_SDA));
+  bool newScl = !(DDRD & _BV(BB_SCL)) || (PORTD & _BV(BB_SCL));
+  if (scl && newScl && sda != newSda) {
+    transfer = !newSda;  // a falling sda is START, a rising one STOP
+    bitCount = 0;
+    byteIndex = 0;
+  } else if (transfer && !scl && newScl) {
+    if (bitCount == 8) {  // the acknowledge clock
+      i2cByte(shifted);
+      bitCount = 0;
+    } else {
+      shifted = shifted << 1 | newSda;
+      bitCount++;
+    }
+  }
+  sda = newSda;
+  scl = newScl;
+}
+
+SimPort &SimPort::operator=(uint8_t v) {
+  value = v;
+  simCharge(SIM_PORT_CYCLES);
+  busChanged();
+  return *this;
+}
+
+//
+// usb serial
+//
+Serial_ Serial;
+std::deque<uint8_t> simSerialIn;
+std::string simSerialOut;
+
+void simSend(const void *data, size_t len) {
+  simSerialIn.insert(simSerialIn.end(), (const uint8_t *)data, (const uint8_t *)data + len);
+}
+
+void simSend(const std::string &data) {
+  simSend(data.data(), data.size());
+}
+
+// bytes sent with simSendAt, in the order they arrive
+static std::deque<std::pair<uint64_t, uint8_t>> serialLater;
+
+void simSendAt(unsigned long us, const void *data, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    serialLater.push_back({(uint64_t)us * CYCLES_PER_US, ((const uint8_t *)data)[i]});
+}
+
+// move the bytes that arrived by now to simSerialIn
+static void serialArrive() {
+  while (!serialLater.empty() && serialLater.front().first <= simCycles) {
+    simSerialIn.push_back(serialLater.front().second);
+    serialLater.pop_front();
+  }
+}
+
+// wait for a byte until deadline, false if none arrived
+static bool serialWait(uint64_t deadline) {
+  serialArrive();
+  if (!simSerialIn.empty())
+    return true;
+  if (!serialLater.empty() && serialLater.front().first <= deadline) {
+    simCharge(serialLater.front().first - simCycles);
+    serialArrive();
+    return true;
+  }
+  if (deadline > simCycles)
+    simCharge(deadline - simCycles);
+  return false;
+}
+
+size_t Print::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t Print::write(const uint8_t *data, size_t len) {
+  simCharge(len * SIM_SERIAL_BYTE_CYCLES);
+  simSerialOut.append((const char *)data, len);
+  return len;
+}
+
+size_t Print::print(long n, int base) {
+  char text[24];
+  snprintf(text, sizeof(text), base == HEX ? "%lx" : "%ld", n);
+  return write(text);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char text[24];
+  snprintf(text, sizeof(text), base == HEX ? "%lx" : "%lu", n);
+  return write(text);
+}
+
+int Stream::available() {
+  simCharge(SIM_CLOCK_READ_CYCLES);
+  serialArrive();
+  return simSerialIn.size();
+}
+
+int Stream::read() {
+  serialArrive();
+  if (simSerialIn.empty())
+    return -1;
+  uint8_t b = simSerialIn.front();
+  simSerialIn.pop_front();
+  return b;
+}
+
+int Stream::peek() {
+  serialArrive();
+  return simSerialIn.empty() ? -1 : simSerialIn.front();
+}
+
+// like the arduino core, every byte is waited for up to the timeout
+size_t Stream::readBytes(uint8_t *buffer, size_t len) {
+  size_t count = 0;
+  while (count < len && serialWait(simCycles + (uint64_t)timeout * 1000 * CYCLES_PER_US)) {
+    buffer[count++] = read();
+  }
+  return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, uint8_t *buffer, size_t len) {
+  size_t count = 0;
+  while (count < len) {
+    if (!serialWait(simCycles + (uint64_t)timeout * 1000 * CYCLES_PER_US))
+      break;
+    uint8_t b = read();
+    if (b == (uint8_t)terminator)
+      break;
+    buffer[count++] = b;
+  }
+  return count;
+}
+
+//
+// sd card with the single block cache of SdFat. files that are not
+// contiguous pay for walking their cluster chain in the FAT
+//
+#define CLUSTER_SIZE 16384
+#define FAT_ENTRIES_PER_BLOCK 128
+#define FAT_FILE -2
+#define DIRECTORY_FILE -3
+
+std::map<std::string, std::vector<uint8_t>> simFiles;
+bool simContiguous = false;
+unsigned long simBlockReads = 0;
+unsigned long simBlockWrites = 0;
+
+static std::vector<std::string> fileNames;         // by file id
+static std::map<std::string, bool> allocatedFiles;  // made by createContiguous
+static uint32_t spiClock = 4000000;
+static cache_t cacheBuffer;
+static int cacheFile = -1;
+static uint32_t cacheBlock;
+static bool cacheDirty = false;
+static int rawFile = -1;  // file of a multi block read, -1 if none is open
+static uint32_t rawBlock;
+
+static int fileId(const std::string &name) {
+  for (size_t id = 0; id < fileNames.size(); id++) {
+    if (fileNames[id] == name)
+      return id;
+  }
+  fileNames.push_back(name);
+  return fileNames.size() - 1;
+}
+
+static std::vector<uint8_t> &fileData(int id) {
+  return simFiles[fileNames[id]];
+}
+
+static void chargeTransfer() {
+  simCharge((uint64_t)(512 + 2) * 8 * F_CPU / spiClock);
+}
+
+static void chargeBlockRead() {
+  simBlockReads++;
+  delayMicroseconds(SIM_SD_ACCESS_US);
+  chargeTransfer();
+}
+
+static void chargeBlockWrite() {
+  simBlockWrites++;
+  delayMicroseconds(SIM_SD_ACCESS_US + SIM_SD_PROGRAM_US);
+  chargeTransfer();
+}
+
+static void flushCache() {
+  if (cacheDirty)
+    chargeBlockWrite();
+  cacheDirty = false;
+}
+
+// bring a block of a file (or of the FAT or a directory) into the cache.
+// the cache buffer gets its data, so what the sketch keeps there goes stale
+static void cacheRead(int file, uint32_t block, bool dirty = false) {
+  if (cacheFile != file || cacheBlock != block) {
+    flushCache();
+    chargeBlockRead();
+    cacheFile = file;
+    cacheBlock = block;
+    memset(cacheBuffer.data, 0xee, 512);
+    if (file >= 0) {
+      std::vector<uint8_t> &data = simFiles[fileNames[file]];
+      if (block * 512 < data.size())
+        memcpy(cacheBuffer.data, data.data() + block * 512, min((size_t)512, data.size() - block * 512));
+    }
+  }
+  cacheDirty |= dirty;
+}
+
+static bool walksFat(int id) {
+  return !allocatedFiles[fileNames[id]];
+}
+
+uint32_t simFirstBlock(const std::string &name) {
+  return 1000 + fileId(name) * 100000UL;
+}
+
+bool SdFat::begin(uint8_t csPin, uint32_t clock) {
+  spiClock = clock;
+  delay(20);  // card initialization
+  return true;
+}
+
+File SdFat::open(const char *path, uint8_t flags) {
+  File file;
+  file.open(vwd(), path, flags);
+  return file;
+}
+
+bool SdFat::exists(const char *path) {
+  cacheRead(DIRECTORY_FILE, 0);
+  return simFiles.count(path);
+}
+
+bool SdFat::remove(const char *path) {
+  cacheRead(DIRECTORY_FILE, 0, true);
+  cacheRead(FAT_FILE, 0, true);
+  allocatedFiles.erase(path);
+  return simFiles.erase(path);
+}
+
+bool FatFile::open(FatFile *dir, const char *path, uint8_t flags) {
+  cacheRead(DIRECTORY_FILE, 0);
+  if (!simFiles.count(path) && !(flags & O_CREAT))
+    return false;
+  if (flags & O_TRUNC)
+    simFiles[path].clear();
+  simFiles[path];
+  id = fileId(path);
+  position = 0;
+  return true;
+}
+
+bool FatFile::createContiguous(FatFile *dir, const char *path, uint32_t size) {
+  if (simFiles.count(path))
+    return false;
+  // searching free clusters and writing the chain
+  for (uint32_t block = 0; block <= size / CLUSTER_SIZE / FAT_ENTRIES_PER_BLOCK; block++) {
+    cacheRead(FAT_FILE, block, true);
+  }
+  cacheRead(DIRECTORY_FILE, 0, true);
+  simFiles[path] = std::vector<uint8_t>(size);
+  allocatedFiles[path] = true;
+  id = fileId(path);
+  position = 0;
+  return true;
+}
+
+bool FatFile::close() {
+  sync();
+  id = -1;
+  return true;
+}
+
+bool FatFile::seekSet(uint32_t pos) {
+  if (!isOpen() || pos > fileSize())
+    return false;
+  if (walksFat(id)) {
+    uint32_t from = position / CLUSTER_SIZE;
+    uint32_t to = pos / CLUSTER_SIZE;
+    if (to < from)
+      from = 0;  // the chain is only linked forward
+    for (uint32_t cluster = from; cluster < to; cluster += FAT_ENTRIES_PER_BLOCK) {
+      cacheRead(FAT_FILE, cluster / FAT_ENTRIES_PER_BLOCK);
+    }
+  }
+  position = pos;
+  return true;
+}
+
+uint32_t FatFile::fileSize() const {
+  return isOpen() ? simFiles[fileNames[id]].size() : 0;
+}
+
+int FatFile::available() {
+  return fileSize() - position;
+}
+
+int FatFile::read() {
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+// copy through the block cache, a new cluster needs its FAT entry
+static void access(int id, uint32_t position, size_t len, bool write) {
+  for (uint32_t pos = position; pos < position + len; pos = (pos / 512 + 1) * 512) {
+    if (pos != position && pos % CLUSTER_SIZE == 0 && walksFat(id))
+      cacheRead(FAT_FILE, pos / CLUSTER_SIZE / FAT_ENTRIES_PER_BLOCK);
+    bool whole = write && pos % 512 == 0 && position + len - pos >= 512;
+    if (whole) {  // SdFat writes whole blocks past the cache
+      if (cacheFile == id && cacheBlock == pos / 512)
+        cacheFile = -1;
+      chargeBlockWrite();
+    } else {
+      cacheRead(id, pos / 512, write);
+    }
+  }
+}
+
+int FatFile::read(void *buffer, size_t len) {
+  if (!isOpen())
+    return -1;
+  std::vector<uint8_t> &data = fileData(id);
+  size_t count = position < data.size() ? min(len, data.size() - position) : 0;
+  access(id, position, count, false);
+  if (buffer)
+    memcpy(buffer, data.data() + position, count);
+  position += count;
+  return count;
+}
+
+int FatFile::write(const void *buffer, size_t len) {
+  if (!isOpen())
+    return -1;
+  std::vector<uint8_t> &data = fileData(id);
+  if (data.size() < position + len)
+    data.resize(position + len);
+  access(id, position, len, true);
+  memcpy(data.data() + position, buffer, len);
+  position += len;
+  return len;
+}
+
+bool FatFile::sync() {
+  flushCache();
+  if (isOpen())
+    cacheRead(DIRECTORY_FILE, 0, true);  // size and date of the entry
+  flushCache();
+  return true;
+}
+
+bool FatFile::truncate(uint32_t length) {
+  fileData(id).resize(length);
+  cacheRead(FAT_FILE, 0, true);
+  if (position > length)
+    position = length;
+  return true;
+}
+
+bool FatFile::rename(FatFile *dir, const char *path) {
+  std::string from = fileNames[id];
+  cacheRead(DIRECTORY_FILE, 0, true);
+  simFiles[path] = simFiles[from];
+  simFiles.erase(from);
+  allocatedFiles[path] = allocatedFiles[from];
+  allocatedFiles.erase(from);
+  id = fileId(path);
+  return true;
+}
+
+bool FatFile::contiguousRange(uint32_t *firstBlock, uint32_t *lastBlock) {
+  if (!isOpen() || !(simContiguous || allocatedFiles[fileNames[id]]))
+    return false;
+  *firstBlock = simFirstBlock(fileNames[id]);
+  *lastBlock = *firstBlock + fileSize() / 512;
+  return true;
+}
+
+cache_t *FatVolume::cacheClear() {
+  flushCache();
+  cacheFile = -1;
+  return &cacheBuffer;
+}
+
+static int rawBlockFile(uint32_t block) {
+  uint32_t id = (block - 1000) / 100000;
+  return block >= 1000 && id < fileNames.size() ? (int)id : -1;
+}
+
+bool SdSpiCard::readStart(uint32_t block) {
+  rawFile = rawBlockFile(block);
+  rawBlock = (block - 1000) % 100000;
+  delayMicroseconds(SIM_SD_ACCESS_US);
+  return rawFile >= 0;
+}
+
+bool SdSpiCard::readData(uint8_t *data) {
+  if (rawFile < 0)
+    return false;
+  simBlockReads++;
+  delayMicroseconds(SIM_SD_TOKEN_US);
+  chargeTransfer();
+  std::vector<uint8_t> &file = fileData(rawFile);
+  for (uint32_t i = 0; i < 512; i++) {
+    uint32_t pos = rawBlock * 512 + i;
+    data[i] = pos < file.size() ? file[pos] : 0;
+  }
+  rawBlock++;
+  return true;
+}
+
+bool SdSpiCard::readStop() {
+  rawFile = -1;
+  return true;
+}
+
+bool SdSpiCard::writeBlock(uint32_t block, const uint8_t *data) {
+  int id = rawBlockFile(block);
+  if (id < 0)
+    return false;
+  chargeBlockWrite();
+  std::vector<uint8_t> &file = fileData(id);
+  uint32_t pos = (block - 1000) % 100000 * 512;
+  if (file.size() < pos + 512)
+    file.resize(pos + 512);
+  memcpy(file.data() + pos, data, 512);
+  return true;
+}
+
+//
+// keyboard, EEPROM and the memory functions of MemoryFree
+//
+SimKeyboard Keyboard;
+SimConsumer Consumer;
+std::string simHidLog;
+
+size_t SimKeyboard::press(KeyboardKeycode key) {
+  delayMicroseconds(SIM_HID_REPORT_US);
+  simHidLog += "+" + std::to_string(key) + " ";
+  return 1;
+}
+
+size_t SimKeyboard::release(KeyboardKeycode key) {
+  delayMicroseconds(SIM_HID_REPORT_US);
+  simHidLog += "-" + std::to_string(key) + " ";
+  return 1;
+}
+
+size_t SimKeyboard::releaseAll() {
+  delayMicroseconds(SIM_HID_REPORT_US);
+  simHidLog += "R ";
+  return 1;
+}
+
+void SimConsumer::press(ConsumerKeycode key) {
+  delayMicroseconds(SIM_HID_REPORT_US);
+  simHidLog += "C+" + std::to_string(key) + " ";
+}
+
+void SimConsumer::release(ConsumerKeycode key) {
+  delayMicroseconds(SIM_HID_REPORT_US);
+  simHidLog += "C-" + std::to_string(key) + " ";
+}
+
+void SimConsumer::releaseAll() {
+  delayMicroseconds(SIM_HID_REPORT_US);
+  simHidLog += "CR ";
+}
+
+EEPROMClass EEPROM;
+uint8_t simEeprom[1024];
+
+uint8_t EEPROMClass::read(int address) {
+  return simEeprom[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  delayMicroseconds(SIM_EEPROM_WRITE_US);
+  simEeprom[address] = value;
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+  if (simEeprom[address] != value)
+    write(address, value);
+}
+
+uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data) {
+  simCharge(SIM_CRC_CYCLES);
+  crc ^= (uint16_t)data << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// the host has no avr heap and stack to measure
+extern "C" {
+int freeMemory() {
+  return 0;
+}
+void paintStack() {}
+int minFreeStack() {
+  return 0;
+}
+}
+
+static struct SimInit {
+  SimInit() {
+    memset(simEeprom, 0xff, sizeof(simEeprom));  // erased
+    for (uint8_t display = 0; display < SIM_DISPLAYS; display++) {
+      resetDisplay(&simDisplays[display]);
+    }
+  }
+} simInit;
+
+//
+// synthetic configs and framed protocol helpers
+//
+static uint8_t pixel(uint32_t image, uint16_t i) {
+  // bands of stripes, half of them the same in every image
+  uint8_t band = i / 128;
+  if (band % 2)
+    return i % 8 < 4 ? 0xff : 0x00;
+  return (uint8_t)(image * 37 + band * 11 + (i % 128) * 3);
+}
+
+std::vector<uint8_t> simConfig(uint16_t pages, bool table) {
+  uint32_t cells = (uint32_t)pages * BD_COUNT;
+  uint16_t imageRow = 1 + cells;
+  std::vector<uint8_t> config(imageRow * ROW_SIZE);
+  config[2] = imageRow & 0xff;
+  config[3] = imageRow >> 8;
+  config[4] = 200;  // contrast
+  config[12] = table ? 0x01 : 0x00;
+  for (uint32_t cell = 0; cell < cells; cell++) {
+    uint8_t *row = &config[(1 + cell) * ROW_SIZE];
+    uint8_t button = cell % BD_COUNT;
+    if (button == BD_COUNT - 1) {  // the last button leads to the next page
+      uint16_t next = (cell / BD_COUNT + 1) % pages;
+      row[0] = 1;
+      row[1] = next & 0xff;
+      row[2] = next >> 8;
+    } else {
+      row[0] = 0;
+      row[1] = 4 + button;
+    }
+    row[ROW_SIZE / 2] = 2;  // no secondary action
+  }
+  uint32_t images = config.size();
+  if (table)
+    images += cells * 4;
+  std::vector<uint32_t> locations;
+  for (uint32_t cell = 0; cell < cells; cell++) {
+    uint32_t image = table && cell % 4 == 3 ? cell - 1 : cell;
+    locations.push_back(images + image * 1025);
+    if (table)
+      config.insert(config.end(), (uint8_t *)&locations.back(), (uint8_t *)&locations.back() + 4);
+  }
+  config.resize(images + cells * 1025);
+  for (uint32_t cell = 0; cell < cells; cell++) {
+    uint8_t *image = &config[images + cell * 1025];
+    image[0] = 0;  // no live data
+    for (uint16_t i = 0; i < 1024; i++) {
+      image[1 + i] = pixel(cell, i);
+    }
+  }
+  return config;
+}
+
+std::vector<uint8_t> simImage(const std::vector<uint8_t> &config, uint16_t page, uint8_t display) {
+  uint32_t imageData = (config[2] | config[3] << 8) * (uint32_t)ROW_SIZE;
+  uint32_t cell = (uint32_t)page * BD_COUNT + display;
+  uint32_t location = imageData + cell * 1025;
+  if (config[12] & 0x01)
+    memcpy(&location, &config[imageData + cell * 4], 4);
+  // the display gets 1024 bytes from the live data byte on
+  return std::vector<uint8_t>(config.begin() + location, config.begin() + location + 1024);
+}
+
+uint16_t simCrc(const uint8_t *data, size_t len, uint16_t crc) {
+  while (len--) {
+    crc ^= (uint16_t)*data++ << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+std::vector<uint8_t> simFrame(uint8_t opcode, const std::vector<uint8_t> &payload, bool badCrc) {
+  std::vector<uint8_t> frame = {opcode, (uint8_t)payload.size(), (uint8_t)(payload.size() >> 8)};
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  uint16_t crc = simCrc(frame.data(), frame.size());
+  if (badCrc)
+    crc ^= 1;
+  frame.insert(frame.begin(), FRAME_MAGIC);
+  frame.push_back(crc & 0xff);
+  frame.push_back(crc >> 8);
+  return frame;
+}
+
+void simSendFrame(uint8_t opcode, const std::vector<uint8_t> &payload, bool badCrc) {
+  std::vector<uint8_t> frame = simFrame(opcode, payload, badCrc);
+  simSend(frame.data(), frame.size());
+}
+
+std::vector<SimReply> simTakeReplies() {
+  std::vector<SimReply> replies;
+  const std::string &out = simSerialOut;
+  size_t i = 0;
+  while (i + 7 <= out.size()) {
+    if ((uint8_t)out[i] != FRAME_MAGIC) {
+      i++;
+      continue;
+    }
+    const uint8_t *frame = (const uint8_t *)out.data() + i + 1;
+    uint16_t len = frame[1] | frame[2] << 8;
+    if (len == 0 || i + 6 + len > out.size())
+      break;
+    SimReply reply;
+    reply.opcode = frame[0];
+    reply.status = frame[3];
+    reply.payload.assign(frame + 4, frame + 3 + len);
+    reply.crcOk = simCrc(frame, 3 + len) == (frame[3 + len] | frame[4 + len] << 8);
+    replies.push_back(reply);
+    i += 6 + len;
+  }
+  simSerialOut.clear();
+  return replies;
+}
+
+std::vector<uint8_t> simU32(uint32_t value) {
+  return {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+}
+
+uint32_t simReadU32(const std::vector<uint8_t> &data, size_t offset) {
+  uint32_t value;
+  memcpy(&value, &data[offset], 4);
+  return value;
+}
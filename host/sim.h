@@ -0,0 +1,90 @@
+// simulated freedeck hardware for the host build: a clock counted in cpu
+// cycles, the usb serial, the sd card, the i2c displays behind the
+// multiplexer, the buttons, the keyboard and the EEPROM
+#pragma once
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// what the simulated clock is charged, in cycles of the 16 MHz cpu.
+// only waiting and i/o take time, the sketch's own computations are free
+#define SIM_CLOCK_READ_CYCLES 60   // micros() and millis()
+#define SIM_PIN_CYCLES 50          // digitalWrite and digitalRead
+#define SIM_PORT_CYCLES 2          // a write to PORTD or DDRD, an i2c edge
+#define SIM_CRC_CYCLES 20          // one _crc_xmodem_update
+#define SIM_SERIAL_BYTE_CYCLES 16  // a byte written to the usb serial
+#define SIM_SD_ACCESS_US 150       // a single block command until its data token
+#define SIM_SD_TOKEN_US 20         // the next block of a multi block read
+#define SIM_SD_PROGRAM_US 600      // the card writing a block
+#define SIM_HID_REPORT_US 50       // a keyboard or consumer report
+#define SIM_EEPROM_WRITE_US 3300   // an EEPROM cell that changes
+
+extern uint64_t simCycles;
+void simCharge(uint64_t cycles);
+unsigned long simMicros();
+// run the main loop for us of simulated time
+void simRun(unsigned long us);
+
+// usb serial, what the host sent and what the sketch answered
+extern std::deque<uint8_t> simSerialIn;
+extern std::string simSerialOut;
+void simSend(const void *data, size_t len);
+void simSend(const std::string &data);
+// bytes arriving at us of simulated time, later than the bytes sent before
+void simSendAt(unsigned long us, const void *data, size_t len);
+
+// the files on the sd card. contiguous files can be read and written with
+// raw block commands, their blocks start at simFirstBlock
+extern std::map<std::string, std::vector<uint8_t>> simFiles;
+extern bool simContiguous;
+extern unsigned long simBlockReads;
+extern unsigned long simBlockWrites;
+uint32_t simFirstBlock(const std::string &name);
+
+// an SSD1306 in horizontal addressing mode
+struct SimDisplay {
+  uint8_t ram[1024];
+  bool on;
+  uint8_t contrast;
+  uint8_t column, columnStart, columnEnd;
+  uint8_t page, pageStart, pageEnd;
+  unsigned long dataBytes;  // display ram bytes written since the start
+};
+#define SIM_DISPLAYS 16
+extern SimDisplay simDisplays[SIM_DISPLAYS];
+extern unsigned long simI2cBytes;
+
+// buttons held down, one bit per multiplexer address
+extern uint16_t simButtonsDown;
+// keyboard reports, +key for a press, -key for a release, R for release all
+extern std::string simHidLog;
+extern uint8_t simEeprom[1024];
+
+// a synthetic config.bin: pages of BD_COUNT buttons, button b pressing key
+// 4 + b, each with its own image. with table set buttons share images
+// through an image table, sharing every fourth image
+std::vector<uint8_t> simConfig(uint16_t pages, bool table = false);
+// the 1024 display bytes config.bin of simConfig shows on a display
+std::vector<uint8_t> simImage(const std::vector<uint8_t> &config, uint16_t page, uint8_t display);
+
+// framed protocol helpers for host drivers
+uint16_t simCrc(const uint8_t *data, size_t len, uint16_t crc = 0xffff);
+std::vector<uint8_t> simFrame(uint8_t opcode, const std::vector<uint8_t> &payload, bool badCrc = false);
+void simSendFrame(uint8_t opcode, const std::vector<uint8_t> &payload, bool badCrc = false);
+struct SimReply {
+  uint8_t opcode;
+  uint8_t status;
+  std::vector<uint8_t> payload;  // after the status byte
+  bool crcOk;
+};
+// parse the reply frames out of simSerialOut and clear it
+std::vector<SimReply> simTakeReplies();
+std::vector<uint8_t> simU32(uint32_t value);
+uint32_t simReadU32(const std::vector<uint8_t> &data, size_t offset);
+
+// the sketch
+void setup();
+void loop();
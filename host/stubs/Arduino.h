@@ -0,0 +1,119 @@
+// stand-in for the arduino core, enough of it for the sketch to build on a
+// linux host. time only moves when the sketch waits or does i/o, see sim.cpp
+#pragma once
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <type_traits>
+
+#define F_CPU 16000000L
+#define ARDUINO 10800
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+#define SERIAL_RX_BUFFER_SIZE 64
+#define SERIAL_TX_BUFFER_SIZE 64
+#define _BV(bit) (1 << (bit))
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *)(s))
+#define PSTR(s) (s)
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+
+template <class T, class U>
+auto min(T a, U b) -> typename std::common_type<T, U>::type {
+  return a < b ? a : b;
+}
+template <class T, class U>
+auto max(T a, U b) -> typename std::common_type<T, U>::type {
+  return a > b ? a : b;
+}
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void simDelayCycles(unsigned long cycles);
+#define __builtin_avr_delay_cycles(cycles) simDelayCycles(cycles)
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+// an i/o register, writes to PORTD and DDRD drive the simulated i2c bus
+class SimPort {
+ public:
+  SimPort &operator=(uint8_t v);
+  SimPort &operator|=(uint8_t v) { return *this = value | v; }
+  SimPort &operator&=(uint8_t v) { return *this = value & v; }
+  operator uint8_t() const { return value; }
+  uint8_t value = 0;
+};
+extern SimPort PORTD, DDRD;
+// the twi registers exist, but only the bit banged transports are simulated
+extern volatile uint8_t TWCR, TWDR, TWBR, TWSR;
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWEN 2
+
+class Print {
+ public:
+  size_t write(uint8_t b);
+  size_t write(const uint8_t *data, size_t len);
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(const __FlashStringHelper *s) { return write((const char *)s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t println() { return write("\r\n"); }
+  template <class T>
+  size_t println(T value) {
+    return print(value) + println();
+  }
+  template <class T>
+  size_t println(T value, int base) {
+    return print(value, base) + println();
+  }
+};
+
+class Stream : public Print {
+ public:
+  int available();
+  int read();
+  int peek();
+  void setTimeout(unsigned long ms) { timeout = ms; }
+  size_t readBytes(uint8_t *buffer, size_t len);
+  size_t readBytes(char *buffer, size_t len) { return readBytes((uint8_t *)buffer, len); }
+  size_t readBytesUntil(char terminator, uint8_t *buffer, size_t len);
+  size_t readBytesUntil(char terminator, char *buffer, size_t len) {
+    return readBytesUntil(terminator, (uint8_t *)buffer, len);
+  }
+
+ private:
+  unsigned long timeout = 1000;
+};
+
+class Serial_ : public Stream {
+ public:
+  void begin(unsigned long baud) {}
+  operator bool() { return true; }
+};
+extern Serial_ Serial;
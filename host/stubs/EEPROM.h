@@ -0,0 +1,11 @@
+// stand-in for the EEPROM library, backed by simEeprom
+#pragma once
+#include <stdint.h>
+
+class EEPROMClass {
+ public:
+  uint8_t read(int address);
+  void write(int address, uint8_t value);
+  void update(int address, uint8_t value);
+};
+extern EEPROMClass EEPROM;
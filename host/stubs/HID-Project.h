@@ -0,0 +1,25 @@
+// stand-in for HID-Project, every report is logged to simHidLog
+#pragma once
+#include <Arduino.h>
+
+enum KeyboardKeycode : uint8_t { KEY_RESERVED = 0 };
+enum ConsumerKeycode : uint16_t { CONSUMER_RESERVED = 0 };
+
+class SimKeyboard {
+ public:
+  void begin() {}
+  size_t press(KeyboardKeycode key);
+  size_t release(KeyboardKeycode key);
+  size_t releaseAll();
+};
+
+class SimConsumer {
+ public:
+  void begin() {}
+  void press(ConsumerKeycode key);
+  void release(ConsumerKeycode key);
+  void releaseAll();
+};
+
+extern SimKeyboard Keyboard;
+extern SimConsumer Consumer;
@@ -0,0 +1,71 @@
+// stand-in for SdFat 1.x, files live in simFiles, see sim.cpp
+#pragma once
+#include <Arduino.h>
+
+#define O_READ 0x01
+#define O_RDONLY O_READ
+#define O_WRITE 0x02
+#define O_WRONLY O_WRITE
+#define O_RDWR (O_READ | O_WRITE)
+#define O_CREAT 0x10
+#define O_TRUNC 0x20
+#define SD_SCK_MHZ(mhz) (1000000UL * (mhz))
+
+union cache_t {
+  uint8_t data[512];
+};
+
+class FatFile {
+ public:
+  bool open(FatFile *dir, const char *path, uint8_t flags);
+  bool createContiguous(FatFile *dir, const char *path, uint32_t size);
+  bool close();
+  bool isOpen() const { return id >= 0; }
+  operator bool() const { return isOpen(); }
+  bool seek(uint32_t pos) { return seekSet(pos); }
+  bool seekSet(uint32_t pos);
+  uint32_t curPosition() const { return position; }
+  uint32_t fileSize() const;
+  int available();
+  int read();
+  int read(void *buffer, size_t len);
+  int write(uint8_t b) { return write(&b, 1); }
+  int write(const void *buffer, size_t len);
+  bool sync();
+  bool truncate(uint32_t length);
+  bool rename(FatFile *dir, const char *path);
+  bool contiguousRange(uint32_t *firstBlock, uint32_t *lastBlock);
+
+  int id = -1;
+  uint32_t position = 0;
+};
+
+class File : public FatFile {};
+
+class SdSpiCard {
+ public:
+  bool readStart(uint32_t block);
+  bool readData(uint8_t *data);
+  bool readStop();
+  bool writeBlock(uint32_t block, const uint8_t *data);
+};
+
+class FatVolume {
+ public:
+  cache_t *cacheClear();
+};
+
+class SdFat {
+ public:
+  bool begin(uint8_t csPin, uint32_t clock);
+  File open(const char *path, uint8_t flags = O_READ);
+  bool exists(const char *path);
+  bool remove(const char *path);
+  FatFile *vwd() { return nullptr; }
+  SdSpiCard *card() { return &spiCard; }
+  FatVolume *vol() { return &volume; }
+
+ private:
+  SdSpiCard spiCard;
+  FatVolume volume;
+};
@@ -0,0 +1,5 @@
+// the avr-libc crc helper the sketch uses
+#pragma once
+#include <stdint.h>
+
+uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data);
@@ -0,0 +1,266 @@
+// tests of the framed protocol on the simulated hardware. the frames are fed
+// to the serial stub as a host would send them and the replies are parsed
+// back out of what the sketch wrote. exits with 1 if a test fails
+#include "../app/settings.h"
+#include "../app/src/FreeDeck.h"
+#include "../app/src/FreeDeckSerialAPI.h"
+#include "../app/version.h"
+#include "./sim.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *test, const char *what) {
+  if (ok)
+    return;
+  printf("FAIL %s: %s\n", test, what);
+  failures++;
+}
+
+static uint16_t u16(const std::vector<uint8_t> &data, size_t offset) {
+  return data.size() < offset + 2 ? 0xffff : data[offset] | data[offset + 1] << 8;
+}
+
+static std::vector<uint8_t> page(uint16_t page) {
+  return {(uint8_t)page, (uint8_t)(page >> 8)};
+}
+
+// one loop pass, its replies
+static std::vector<SimReply> pass() {
+  loop();
+  return simTakeReplies();
+}
+
+static bool answered(const std::vector<SimReply> &replies, uint8_t opcode, uint8_t status) {
+  return replies.size() == 1 && replies[0].opcode == opcode && replies[0].status == status &&
+         replies[0].crcOk;
+}
+
+static void testVersion() {
+  simSendFrame(0x10, {});
+  std::vector<SimReply> replies = pass();
+  check(answered(replies, 0x10, 0), "version", "reply");
+  if (!replies.empty()) {
+    std::string version(replies[0].payload.begin(), replies[0].payload.end());
+    check(version == FW_VERSION, "version", "payload");
+  }
+}
+
+static void testBadCrc() {
+  simSendFrame(0x31, page(3), true);
+  check(answered(pass(), 0x31, 1), "bad crc", "reply");
+  check(currentPage != 3, "bad crc", "page changed");
+}
+
+// page count is past the last page
+static void testPageOutOfRange() {
+  simSendFrame(0x31, page(12));
+  check(answered(pass(), 0x31, 3), "page out of range", "reply");
+  check(currentPage != 12, "page out of range", "page changed");
+}
+
+static void testUnknown() {
+  simSendFrame(0x7f, {1, 2, 3});
+  check(answered(pass(), 0x7f, 2), "unknown opcode", "reply");
+}
+
+// frames sent back to back are all answered in one pass, in order
+static void testPipelined() {
+  simSendFrame(0x32, {});
+  simSendFrame(0x31, page(2));
+  simSendFrame(0x30, {});
+  std::vector<SimReply> replies = pass();
+  check(replies.size() == 3, "pipelined", "reply count");
+  if (replies.size() != 3)
+    return;
+  check(replies[0].opcode == 0x32 && u16(replies[0].payload, 0) == 12, "pipelined", "page count");
+  check(replies[1].opcode == 0x31 && replies[1].status == 0, "pipelined", "set page");
+  check(replies[2].opcode == 0x30 && u16(replies[2].payload, 0) == 2, "pipelined", "get page");
+}
+
+// newlines end legacy commands, in a payload they are just bytes
+static void testNewlinePayload() {
+  simSendFrame(0x31, page(0x0a));
+  simSendFrame(0x30, {});
+  std::vector<SimReply> replies = pass();
+  check(replies.size() == 2, "newline payload", "reply count");
+  if (replies.size() == 2)
+    check(u16(replies[1].payload, 0) == 0x0a, "newline payload", "get page");
+  check(currentPage == 0x0a, "newline payload", "page");
+}
+
+// the rest of a frame arriving within the serial timeout is waited for
+static void testSplit() {
+  std::vector<uint8_t> frame = simFrame(0x31, page(4));
+  simSend(frame.data(), 3);
+  simSendAt(simMicros() + 50000, frame.data() + 3, frame.size() - 3);
+  check(answered(pass(), 0x31, 0), "split", "reply");
+  check(currentPage == 4, "split", "page");
+}
+
+// a frame cut off by the serial timeout is rejected, the late rest is dropped
+// and the next frame is answered again
+static void testCutOff() {
+  std::vector<uint8_t> frame = simFrame(0x31, page(5));
+  simSend(frame.data(), 4);
+  simSendAt(simMicros() + 500000, frame.data() + 4, frame.size() - 4);
+  check(answered(pass(), 0x31, 1), "cut off", "reply");
+  simRun(600000);
+  check(simTakeReplies().empty(), "cut off", "rest answered");
+  check(currentPage == 4, "cut off", "page changed");
+  simSendFrame(0x10, {});
+  check(answered(pass(), 0x10, 0), "cut off", "next frame");
+}
+
+// legacy commands still work after frames in the same pass
+static void testLegacyAfterFrames() {
+  simSendFrame(0x32, {});
+  simSend("\x03\n\x31\n7\n");
+  check(answered(pass(), 0x32, 0), "legacy after frames", "reply");
+  check(currentPage == 7, "legacy after frames", "page");
+  simSendFrame(0x30, {});
+  std::vector<SimReply> replies = pass();
+  check(answered(replies, 0x30, 0), "legacy after frames", "get page");
+  if (!replies.empty())
+    check(u16(replies[0].payload, 0) == 7, "legacy after frames", "framed page");
+}
+
+// a dump after a patch in the same pass reuses the sd cache, the rows read
+// afterwards still come from the card. button 0 has to type key 4
+static void testPatchThenDump() {
+  simSendFrame(0x31, page(0));
+  check(answered(pass(), 0x31, 0), "patch then dump", "page");
+  const std::vector<uint8_t> &config = simFiles[CONFIG_NAME];
+  std::vector<uint8_t> patch = {0, 0, 0};
+  patch.insert(patch.end(), config.begin() + ROW_SIZE, config.begin() + 2 * ROW_SIZE);
+  simSendFrame(0x26, patch);
+  std::vector<uint8_t> range = simU32(9000);
+  std::vector<uint8_t> length = simU32(16);
+  range.insert(range.end(), length.begin(), length.end());
+  simSendFrame(0x28, range);
+  std::vector<SimReply> replies = pass();
+  check(replies.size() == 3 && replies[0].status == 0 && replies[2].status == 0, "patch then dump",
+        "replies");
+  load_buttons(currentPage);  // like a release that leaves to the page
+  simHidLog.clear();
+  simButtonsDown = 1;
+  simRun(50000);
+  simButtonsDown = 0;
+  simRun(50000);
+  check(simHidLog.compare(0, 3, "+4 ") == 0, "patch then dump", "key");
+}
+
+static std::vector<uint8_t> uploadBegin(const std::vector<uint8_t> &data, size_t len) {
+  std::vector<uint8_t> payload = simU32(len);
+  uint16_t crc = simCrc(data.data(), len);
+  payload.push_back(crc & 0xff);
+  payload.push_back(crc >> 8);
+  return payload;
+}
+
+static std::vector<uint8_t> uploadBlock(uint32_t offset, const std::vector<uint8_t> &data, size_t len) {
+  std::vector<uint8_t> payload = simU32(offset);
+  payload.insert(payload.end(), data.begin() + offset, data.begin() + offset + len);
+  return payload;
+}
+
+static bool received(const std::vector<SimReply> &replies, uint8_t status, uint32_t bytes) {
+  return answered(replies, 0x24, status) && replies[0].payload.size() == 4 &&
+         simReadU32(replies[0].payload, 0) == bytes;
+}
+
+// blocks are only taken in order and full up to the end of the upload,
+// a block past the end is refused and the commit finds the upload complete
+static void testUpload() {
+  std::vector<uint8_t> data(1100);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = i * 7;
+  simSendFrame(0x23, simU32(600));
+  check(answered(pass(), 0x23, 3), "upload", "begin without crc");
+  simSendFrame(0x23, uploadBegin(data, 600));
+  check(answered(pass(), 0x23, 0), "upload", "begin");
+  simSendFrame(0x24, uploadBlock(0, data, 100));
+  check(received(pass(), 3, 0), "upload", "short block");
+  simSendFrame(0x24, uploadBlock(0, data, 512));
+  check(received(pass(), 0, 512), "upload", "first block");
+  simSendFrame(0x24, uploadBlock(512, data, 512));
+  check(received(pass(), 3, 512), "upload", "block past the end");
+  simSendFrame(0x24, uploadBlock(512, data, 88));
+  check(received(pass(), 0, 600), "upload", "last block");
+  simSendFrame(0x24, uploadBlock(600, data, 500));
+  check(received(pass(), 3, 600), "upload", "block after the last one");
+  simSendFrame(0x25, {1});
+  check(answered(pass(), 0x25, 0), "upload", "commit");
+  check(simFiles["config1.bin"] == std::vector<uint8_t>(data.begin(), data.begin() + 600), "upload",
+        "file");
+}
+
+static bool begun(const std::vector<SimReply> &replies, uint32_t bytes) {
+  return answered(replies, 0x23, 0) && replies[0].payload.size() == 4 &&
+         simReadU32(replies[0].payload, 0) == bytes;
+}
+
+// an upload resumes only for the same file, another file of the same size
+// starts over and blocks of the old one are not committed with it
+static void testUploadRestart() {
+  const uint32_t size = UPLOAD_TRAILER_INTERVAL * 512 + 88;
+  const uint32_t last = size - 88;
+  std::vector<uint8_t> first(size, 1), second(size, 2);
+  simSendFrame(0x23, uploadBegin(first, size));
+  check(begun(pass(), 0), "upload restart", "begin");
+  for (uint32_t offset = 0; offset < last; offset += 512) {
+    simSendFrame(0x24, uploadBlock(offset, first, 512));
+    check(received(pass(), 0, offset + 512), "upload restart", "first file");
+  }
+  simSendFrame(0x23, uploadBegin(first, size));
+  check(begun(pass(), last), "upload restart", "resume");
+  simSendFrame(0x23, uploadBegin(second, size));
+  check(begun(pass(), 0), "upload restart", "another file");
+  for (uint32_t offset = 0; offset < last; offset += 512) {
+    simSendFrame(0x24, uploadBlock(offset, second, 512));
+    check(received(pass(), 0, offset + 512), "upload restart", "second file");
+  }
+  // the end of the first file does not fit the crc of the second
+  simSendFrame(0x24, uploadBlock(last, first, 88));
+  check(received(pass(), 0, size), "upload restart", "spliced block");
+  simSendFrame(0x25, {2});
+  check(answered(pass(), 0x25, 3), "upload restart", "spliced commit");
+  check(!simFiles.count("config2.bin"), "upload restart", "spliced file");
+}
+
+// a legacy upload replaces TEMP_FILE, the block upload in it is gone
+static void testUploadAfterLegacy() {
+  std::vector<uint8_t> data(600, 3);
+  simSendFrame(0x23, uploadBegin(data, 600));
+  check(begun(pass(), 0), "upload after legacy", "begin");
+  std::vector<uint8_t> config = simFiles[CONFIG_NAME];
+  simSend("\x03\n\x21\n" + std::to_string(config.size()) + "\n");
+  simSend(config.data(), config.size());
+  loop();
+  simTakeReplies();
+  simSendFrame(0x24, uploadBlock(0, data, 512));
+  check(received(pass(), 3, 0), "upload after legacy", "block");
+}
+
+int main() {
+  simFiles[CONFIG_NAME] = simConfig(12);
+  simContiguous = true;  // like every config uploaded with 0x23
+  setup();
+  simSerialOut.clear();
+
+  testVersion();
+  testBadCrc();
+  testPageOutOfRange();
+  testUnknown();
+  testPipelined();
+  testNewlinePayload();
+  testSplit();
+  testCutOff();
+  testLegacyAfterFrames();
+  testPatchThenDump();
+  testUpload();
+  testUploadRestart();
+  testUploadAfterLegacy();
+
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}